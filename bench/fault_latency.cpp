@@ -0,0 +1,116 @@
+// Measures the latency distribution of Controller operations on simulated
+// DLPC350s whose replies are delayed, dropped or damaged by a FaultTransport.
+// Reports p50/p99/p999/max per operation, so regressions in the tail (e.g.
+// timeouts or retry loops running to their limit) show up next to the median.
+
+#include "multi350/controller.hpp"
+#include "multi350/fault.hpp"
+#include "multi350/sim.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace multi350;
+using namespace std::chrono_literals;
+
+static void measure(const std::string &name, unsigned int iterations,
+                    const std::function<bool()> &operation) {
+  std::vector<std::chrono::microseconds> samples;
+  unsigned int failures = 0;
+
+  for (unsigned int i = 0; i < iterations; i++) {
+    auto start = std::chrono::steady_clock::now();
+    if (!operation())
+      ++failures;
+    samples.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start));
+  }
+
+  std::sort(samples.begin(), samples.end());
+  auto percentile = [&samples](double p) {
+    auto index = static_cast<size_t>(p * (samples.size() - 1));
+    return samples[index].count();
+  };
+
+  std::cout << name << ": n " << samples.size() << " failed " << failures
+            << " p50 " << percentile(0.5) << "us p99 " << percentile(0.99)
+            << "us p999 " << percentile(0.999) << "us max "
+            << samples.back().count() << "us" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned int iterations = argc > 1 ? std::atoi(argv[1]) : 200;
+  uint32_t seed = argc > 2 ? std::atoi(argv[2]) : 1;
+  constexpr unsigned int projectorNum = 4;
+
+  sim::Timing timing;
+  timing.displayModeSwitch = timing.patternStatusSwitch = 5ms;
+
+  sim::Faults faults;
+  faults.latency = 500us;
+  faults.jitter = 1ms;
+  faults.spikeRate = 0.01;
+  faults.spike = 20ms;
+  faults.dropRate = 0.001;
+  faults.errorRate = 0.001;
+  faults.shortReadRate = 0.001;
+
+  sim::Bus bus(timing);
+  bus.add(projectorNum);
+
+  std::vector<std::unique_ptr<USB::Transport>> transports;
+  std::vector<sim::FaultTransport *> faulty;
+  for (auto &transport : bus.openAll()) {
+    faults.seed = seed++;
+    auto wrapped =
+        std::make_unique<sim::FaultTransport>(std::move(transport), faults);
+    faulty.push_back(wrapped.get());
+    transports.push_back(std::move(wrapped));
+  }
+
+  Controller controller;
+  if (!controller.open(std::move(transports))) {
+    std::cerr << "[bench] Failed to open simulated projectors" << std::endl;
+    return 1;
+  }
+
+  std::vector<LEDCurrent> currents(projectorNum, LEDCurrent(0x97, 0x78, 0x7D));
+  PatternSequence patternSequence;
+  patternSequence.addPattern(Pattern::TriggerType::INTERNAL,
+                             Pattern::Pattern8bit::G7G6G5G4G3G2G1G0, 8,
+                             Pattern::LEDSelect::GREEN);
+
+  measure("updateStatus", iterations,
+          [&controller] { return controller.updateStatus(); });
+  measure("setLEDCurrent", iterations, [&controller, &currents] {
+    return controller.setLEDCurrent(currents);
+  });
+
+  // sequence start/stop polls for the status change, keep the count low
+  unsigned int slowIterations = std::max(10u, iterations / 20);
+  measure("startPatternSequence", slowIterations, [&] {
+    return controller.startPatternSequence(patternSequence);
+  });
+  measure("stopPatternSequence", slowIterations,
+          [&controller] { return controller.stopPatternSequence(); });
+
+  sim::FaultStats total;
+  for (auto *transport : faulty) {
+    auto &stats = transport->getStats();
+    total.replies += stats.replies;
+    total.spikes += stats.spikes;
+    total.dropped += stats.dropped;
+    total.errors += stats.errors;
+    total.shortReads += stats.shortReads;
+  }
+  std::cout << "replies " << total.replies << " spikes " << total.spikes
+            << " dropped " << total.dropped << " errors " << total.errors
+            << " short " << total.shortReads << std::endl;
+
+  controller.close();
+  return 0;
+}
@@ -0,0 +1,84 @@
+// Counts heap allocations on the steady state packet path. Status polling and
+// setters are run against a simulated DLPC350 with zero response time, so the
+// numbers reflect the library overhead alone. Exits non-zero if any
+// allocation is made after warm-up.
+
+#include "multi350/dlpc350.hpp"
+#include "multi350/sim.hpp"
+#include "multi350/usb.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+static std::atomic<uint64_t> allocations{0};
+
+void *operator new(std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *ptr = std::malloc(size ? size : 1))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+using namespace multi350;
+
+static bool poll(USB::Device &device) {
+  HardwareStatus hardwareStatus;
+  SystemStatus systemStatus;
+  MainStatus mainStatus;
+
+  return getHardwareStatus(device, hardwareStatus) &&
+         getSystemStatus(device, systemStatus) &&
+         getMainStatus(device, mainStatus) &&
+         setLEDCurrent(device, 0x97, 0x78, 0x7D) &&
+         setPatternStatus(device, PatternStatus::STOP);
+}
+
+int main(int argc, char *argv[]) {
+  unsigned int iterations = argc > 1 ? std::atoi(argv[1]) : 10000;
+
+  sim::Timing timing;
+  timing.packetInterval = timing.processing = std::chrono::microseconds(0);
+  timing.displayModeSwitch = timing.patternStatusSwitch =
+      timing.powerModeSwitch = std::chrono::microseconds(0);
+
+  sim::Bus bus(timing);
+  bus.add();
+  auto &device = USB::attach(std::move(bus.openAll().front()));
+
+  for (unsigned int i = 0; i < 100; i++) {
+    if (!poll(device)) {
+      std::cerr << "[bench] Warm-up failed" << std::endl;
+      return 1;
+    }
+  }
+
+  auto before = allocations.load();
+  auto start = std::chrono::steady_clock::now();
+
+  for (unsigned int i = 0; i < iterations; i++) {
+    if (!poll(device)) {
+      std::cerr << "[bench] Transaction failed" << std::endl;
+      return 1;
+    }
+  }
+
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  auto allocated = allocations.load() - before;
+  auto transactions = iterations * 5;
+
+  std::cout << "transactions: " << transactions << std::endl;
+  std::cout << "ns/transaction: "
+            << std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+                       .count() /
+                   transactions
+            << std::endl;
+  std::cout << "allocations: " << allocated << std::endl;
+
+  USB::close();
+  return allocated == 0 ? 0 : 1;
+}
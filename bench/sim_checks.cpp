@@ -0,0 +1,250 @@
+// Behaviour checks of the packet path against a loopback transport and the
+// simulated DLPC350, run by ctest with the name of the check:
+//   reply_matching  replies read out of order and foreign replies in between
+//                   are handed to the request they answer
+//   reassembly      a pattern LUT reply spanning several reports is read back
+//                   whole, also between pipelined requests
+//   delta_upload    an upload after a full one only sends the changed entries
+//   reconnect       a projector that failed and came back has its LED current
+//                   and running sequence restored by the controller
+// Exits non-zero if the check fails.
+
+#include "multi350/commands.hpp"
+#include "multi350/controller.hpp"
+#include "multi350/dlpc350.hpp"
+#include "multi350/sim.hpp"
+#include "multi350/transport.hpp"
+#include "multi350/usb.hpp"
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace multi350;
+
+static bool check(bool condition, const char *what) {
+  if (!condition)
+    std::cerr << "[check] Failed: " << what << std::endl;
+  return condition;
+}
+
+static sim::Timing fastTiming() {
+  sim::Timing timing;
+  timing.packetInterval = timing.processing = std::chrono::microseconds(0);
+  timing.displayModeSwitch = timing.patternStatusSwitch =
+      timing.powerModeSwitch = std::chrono::microseconds(0);
+  return timing;
+}
+
+// the three replies are held back and sent in reverse order, each preceded by
+// one with a sequence no request was sent with
+static bool replyMatching() {
+  std::vector<std::array<uint8_t, USB::packetSize>> held;
+  auto responder = [&held](const uint8_t *packet,
+                           USB::LoopbackTransport &loopback) {
+    std::array<uint8_t, USB::packetSize> reply{};
+    memcpy(reply.data(), packet, 4);
+    reply[2] = 1;
+    reply[3] = 0;
+    reply[4] = packet[4]; // CMD3 of the request
+    held.push_back(reply);
+    if (held.size() < 3)
+      return;
+
+    for (auto it = held.rbegin(); it != held.rend(); ++it) {
+      auto foreign = *it;
+      foreign[1] ^= 0x80;
+      foreign[4] = 0xFF;
+      loopback.push(foreign.data(), foreign.size());
+      loopback.push(it->data(), it->size());
+    }
+    held.clear();
+  };
+
+  auto &device = USB::attach(
+      std::make_unique<USB::LoopbackTransport>("loopback", responder));
+  Pipeline pipeline(device);
+  auto hardware = pipeline.postGet(commands::HardwareStatus::opcode);
+  auto system = pipeline.postGet(commands::SystemStatus::opcode);
+  auto main = pipeline.postGet(commands::MainStatus::opcode);
+
+  uint8_t hardwareValue = 0, systemValue = 0, mainValue = 0;
+  return check(pipeline.wait(main, mainValue) &&
+                   pipeline.wait(hardware, hardwareValue) &&
+                   pipeline.wait(system, systemValue),
+               "all replies received") &&
+         check(hardwareValue == (commands::HardwareStatus::opcode & 0xFF) &&
+                   systemValue == (commands::SystemStatus::opcode & 0xFF) &&
+                   mainValue == (commands::MainStatus::opcode & 0xFF),
+               "replies handed to their requests");
+}
+
+static bool reassembly() {
+  sim::Bus bus(fastTiming());
+  bus.add();
+  auto &device = USB::attach(std::move(bus.openAll().front()));
+
+  PatternSequence patternSequence;
+  for (int i = 0; i < 100; i++) {
+    patternSequence.addPattern(Pattern::TriggerType::INTERNAL,
+                               static_cast<Pattern::Pattern8bit>(i % 3), 8,
+                               Pattern::LEDSelect::GREEN);
+  }
+  if (!check(sendPatternDisplayLUT(device, patternSequence) &&
+                 configurePatternSequence(device, patternSequence),
+             "pattern LUT uploaded"))
+    return false;
+
+  auto matches = [&patternSequence](const uint8_t *entry, size_t i) {
+    return memcmp(entry, &patternSequence.getPattern(i).value,
+                  commands::PatternLUT::entrySize) == 0;
+  };
+
+  PatternSequence readBack;
+  bool result = check(getPatternDisplayLUT(device, readBack),
+                      "pattern LUT read") &&
+                check(readBack.getPatternNum() == 100, "all patterns read");
+  for (size_t i = 0; result && i < readBack.getPatternNum(); i++) {
+    result = check(matches(reinterpret_cast<const uint8_t *>(
+                               &readBack.getPattern(i).value),
+                           i),
+                   "patterns read back as uploaded");
+  }
+  if (!result)
+    return false;
+
+  // the long reply is reassembled between the replies around it
+  if (!setMailboxMode(device, MailboxMode::PATTERN) ||
+      !setMailboxOffset(device, 0))
+    return check(false, "mailbox opened");
+  {
+    Pipeline pipeline(device);
+    auto hardware = pipeline.postGet(commands::HardwareStatus::opcode);
+    auto lut = pipeline.postGet(commands::PatternLUT::opcode);
+    auto main = pipeline.postGet(commands::MainStatus::opcode);
+
+    HardwareStatus hardwareStatus;
+    commands::PatternLUT::Reply lutValue{};
+    MainStatus mainStatus;
+    result = check(pipeline.wait(hardware, hardwareStatus) &&
+                       pipeline.wait(lut, lutValue) &&
+                       pipeline.wait(main, mainStatus),
+                   "pipelined replies received") &&
+             check(matches(&lutValue[99 * commands::PatternLUT::entrySize],
+                           99),
+                   "last pattern of the pipelined LUT");
+  }
+  return setMailboxMode(device, MailboxMode::DISABLE) && result;
+}
+
+static bool deltaUpload() {
+  sim::Bus bus(fastTiming());
+  auto &simulator = bus.add();
+  auto &device = USB::attach(std::move(bus.openAll().front()));
+
+  auto varExpPatSequence = std::make_unique<VarExpPatSequence>();
+  for (size_t i = 0; i < 300; i++) {
+    varExpPatSequence->addVarExpPat<Pattern::Pattern1bit>(
+        1000 + i, 1000 + i, Pattern::TriggerType::NO_TRIGGER,
+        static_cast<Pattern::Pattern1bit>(i % 24), 1,
+        Pattern::LEDSelect::GREEN);
+  }
+
+  auto matches = [&simulator, &varExpPatSequence] {
+    auto registers = simulator.getRegisters();
+    return memcmp(registers.varExpPatLUT.data(),
+                  &varExpPatSequence->getVarExpPat(0),
+                  varExpPatSequence->getVarExpPatNum() *
+                      sizeof(VarExpPat)) == 0;
+  };
+
+  auto before = simulator.getMessageNum();
+  if (!check(sendVarExpPatDisplayLUT(device, *varExpPatSequence) &&
+                 matches(),
+             "full upload"))
+    return false;
+  auto full = simulator.getMessageNum() - before;
+
+  varExpPatSequence->getVarExpPat(150).exposure += 100;
+  before = simulator.getMessageNum();
+  if (!check(sendVarExpPatDisplayLUT(device, *varExpPatSequence) &&
+                 matches(),
+             "upload of a changed entry"))
+    return false;
+  auto changed = simulator.getMessageNum() - before;
+
+  // mailbox open, offset, entry and mailbox closed
+  return check(changed <= 4 && changed < full,
+               "only the changed entry is sent");
+}
+
+static bool reconnect() {
+  using namespace std::chrono_literals;
+
+  sim::Timing timing;
+  timing.powerModeSwitch = std::chrono::microseconds(1000);
+  sim::Bus bus(timing);
+  bus.add(2);
+
+  Controller controller;
+  if (!check(controller.open(bus.openAll()), "projectors opened"))
+    return false;
+  controller.startMonitor(bus.getEnumerator(), bus.getOpener());
+
+  PatternSequence patternSequence;
+  patternSequence.addPattern(Pattern::TriggerType::INTERNAL,
+                             Pattern::Pattern8bit::G7G6G5G4G3G2G1G0, 8,
+                             Pattern::LEDSelect::GREEN);
+  bool result =
+      check(controller.setLEDCurrent(1, LEDCurrent(10, 20, 30)),
+            "LED current set") &&
+      check(controller.startPatternSequence(patternSequence),
+            "sequence started");
+
+  // the transport fails on the next command, the monitor reopens it once the
+  // device is back
+  bus.remove("sim:0001");
+  controller.stopPatternSequence();
+  controller.startPatternSequence(patternSequence);
+  auto &simulator = bus.replug("sim:0001");
+
+  auto restored = [&simulator] {
+    auto registers = simulator.getRegisters();
+    return registers.patternStatus ==
+               static_cast<uint8_t>(PatternStatus::START) &&
+           registers.ledCurrent[0] == 255 - 10;
+  };
+  auto deadline = std::chrono::steady_clock::now() + 5s;
+  while (!restored() && std::chrono::steady_clock::now() < deadline)
+    std::this_thread::sleep_for(1ms);
+
+  result = check(restored(), "state restored after reconnect") && result;
+  controller.close();
+  return result;
+}
+
+int main(int argc, char *argv[]) {
+  std::string name = argc > 1 ? argv[1] : "";
+  bool result;
+  if (name == "reply_matching") {
+    result = replyMatching();
+  } else if (name == "reassembly") {
+    result = reassembly();
+  } else if (name == "delta_upload") {
+    result = deltaUpload();
+  } else if (name == "reconnect") {
+    result = reconnect();
+  } else {
+    std::cerr << "usage: " << argv[0]
+              << " reply_matching|reassembly|delta_upload|reconnect"
+              << std::endl;
+    return 2;
+  }
+
+  USB::close();
+  return result ? 0 : 1;
+}
@@ -0,0 +1,106 @@
+// Measures the upload time of variable exposure pattern LUTs of increasing
+// length to a simulated DLPC350 with the default report timing. Each length is
+// uploaded with sendVarExpPatDisplayLUT, which packs as many entries as fit a
+// message, and with the former scheme of an offset and a single entry per
+// message. The upload of a single changed entry, which is all that is sent
+// after a full upload, is timed as well. The uploaded LUT is compared with the
+// registers of the simulator.
+
+#include "multi350/commands.hpp"
+#include "multi350/dlpc350.hpp"
+#include "multi350/sim.hpp"
+#include "multi350/usb.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+using namespace multi350;
+
+// one offset and one entry per message, as uploaded before entries were packed
+static bool sendPerEntry(USB::Device &device,
+                         VarExpPatSequence &varExpPatSequence) {
+  Batch batch(device);
+  batch.set<commands::MailboxMode>(MailboxMode::VAR_EXPOSURE_PATTERN);
+  for (size_t i = 0; i < varExpPatSequence.getVarExpPatNum(); i++) {
+    batch.set<commands::MailboxVarExpOffset>(i);
+
+    auto &varExpPat = varExpPatSequence.getVarExpPat(i);
+    batch.setEntries<commands::VarExpPatLUT>(
+        1, [&varExpPat](Encoder &encoder) {
+          addEntry<commands::VarExpPatLUT>(encoder, &varExpPat);
+        });
+  }
+  batch.set<commands::MailboxMode>(MailboxMode::DISABLE);
+  return batch.commit();
+}
+
+// forget the last upload, so the next one sends the whole LUT
+static void forget(USB::Device &device) {
+  std::lock_guard<std::mutex> lock(device.getMutex());
+  device.getUploadRecord().clear();
+}
+
+static bool matches(sim::Simulator &simulator,
+                    VarExpPatSequence &varExpPatSequence) {
+  auto registers = simulator.getRegisters();
+  for (size_t i = 0; i < varExpPatSequence.getVarExpPatNum(); i++) {
+    if (memcmp(&registers.varExpPatLUT[i * sizeof(VarExpPat)],
+               &varExpPatSequence.getVarExpPat(i), sizeof(VarExpPat)) != 0)
+      return false;
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  // the per entry upload of a full LUT takes seconds, skip it past this length
+  size_t perEntryLimit = argc > 1 ? std::atoi(argv[1]) : maxVarExpPats;
+
+  sim::Bus bus;
+  auto &simulator = bus.add();
+  auto &device = USB::attach(std::move(bus.openAll().front()));
+
+  auto varExpPatSequence = std::make_unique<VarExpPatSequence>();
+  size_t lengths[] = {1, 12, 42, 43, 128, 480, 1024, maxVarExpPats};
+
+  std::cout << "entries packed(ms) one-changed(ms) per-entry(ms)" << std::endl;
+  for (auto length : lengths) {
+    varExpPatSequence->clear();
+    for (size_t i = 0; i < length; i++) {
+      varExpPatSequence->addVarExpPat<Pattern::Pattern1bit>(
+          1000 + i, 1000 + i, Pattern::TriggerType::NO_TRIGGER,
+          static_cast<Pattern::Pattern1bit>(i % 24), 1,
+          Pattern::LEDSelect::GREEN);
+    }
+
+    auto measure = [&](auto &&upload) {
+      auto start = std::chrono::steady_clock::now();
+      bool result = upload(device, *varExpPatSequence);
+      std::chrono::duration<double, std::milli> elapsed =
+          std::chrono::steady_clock::now() - start;
+      if (!result || !matches(simulator, *varExpPatSequence)) {
+        std::cerr << "[bench] Upload of " << length << " entries failed"
+                  << std::endl;
+        std::exit(1);
+      }
+      return elapsed.count();
+    };
+
+    auto send = [](auto &device, auto &sequence) {
+      return sendVarExpPatDisplayLUT(device, sequence);
+    };
+    forget(device);
+    std::cout << length << " " << measure(send);
+
+    varExpPatSequence->getVarExpPat(length / 2).exposure += 100;
+    std::cout << " " << measure(send);
+    if (length <= perEntryLimit)
+      std::cout << " " << measure(sendPerEntry);
+    std::cout << std::endl;
+  }
+
+  USB::close();
+  return 0;
+}
@@ -0,0 +1,106 @@
+#ifndef MULTI350_ASYNC_HPP
+#define MULTI350_ASYNC_HPP
+
+#include "message.hpp"
+#include "usb.hpp"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+namespace multi350 {
+
+/// @brief Dedicated I/O thread of a single device. Submitted messages are
+/// written in pipelined bursts and their completions are called from this
+/// thread once the device lock is released, so completions may issue further
+/// commands.
+class AsyncWorker {
+public:
+  /// @brief Called with the reply of a message, empty on failure. The view is
+  /// only valid during the call.
+  using Completion = std::function<void(ReplyView reply)>;
+
+  explicit AsyncWorker(USB::Device &_device);
+  ~AsyncWorker();
+
+  AsyncWorker(const AsyncWorker &) = delete;
+  AsyncWorker &operator=(const AsyncWorker &) = delete;
+
+  /// @brief Queue a message expecting a reply
+  /// @param msg Message to send
+  /// @param completion Called with the reply
+  void submit(const Message &msg, Completion completion);
+
+  /// @brief Queue a function to run on the I/O thread, e.g. a blocking
+  /// command spanning several messages. Runs after the messages queued
+  /// before it have completed.
+  /// @param function Function to run
+  void execute(std::function<void()> function);
+
+  /// @brief Number of messages queued or in flight
+  size_t getPendingNum();
+
+private:
+  struct Job {
+    Message msg;
+    Completion completion;
+    std::function<void()> function;
+  };
+
+  void run();
+
+  USB::Device &device;
+  std::deque<Job> jobs;
+  size_t running;
+  bool stopping;
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::thread thread;
+};
+
+/// @brief Send a message on the I/O thread of the device
+/// @param completion Called with the reply, empty on failure
+extern void transactAsync(USB::Device &device, const Message &msg,
+                          AsyncWorker::Completion completion);
+
+/// @brief Send a message on the I/O thread of the device
+/// @return Future set to true once the message is acknowledged
+extern std::future<bool> transactAsync(USB::Device &device, const Message &msg);
+
+/// @brief Read a value on the I/O thread of the device
+/// @return Future holding the value, empty on failure
+template <typename T>
+std::future<std::optional<T>> sendGetMessageAsync(USB::Device &device,
+                                                  uint16_t cmd) {
+  auto promise = std::make_shared<std::promise<std::optional<T>>>();
+  auto future = promise->get_future();
+
+  transactAsync(device, Message(Message::Type::READ, cmd),
+                [promise](ReplyView reply) {
+                  if (!reply) {
+                    promise->set_value(std::nullopt);
+                    return;
+                  }
+
+                  T value;
+                  reply.copyTo(value);
+                  promise->set_value(value);
+                });
+
+  return future;
+}
+
+/// @brief Write a value on the I/O thread of the device
+/// @return Future set to true once the message is acknowledged
+template <typename... ParamList>
+std::future<bool> sendSetMessageAsync(USB::Device &device, uint16_t cmd,
+                                      ParamList &&...params) {
+  return transactAsync(device, Message(Message::Type::WRITE, cmd,
+                                       std::forward<ParamList>(params)...));
+}
+}; // namespace multi350
+
+#endif
@@ -0,0 +1,210 @@
+#ifndef MULTI350_CAPTURE_HPP
+#define MULTI350_CAPTURE_HPP
+
+#include "transport.hpp"
+#include "usb.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace multi350 {
+namespace USB {
+
+/// @brief Single report of a captured session
+struct CaptureEntry {
+  enum class Type : uint8_t {
+    WRITE = 1,   // report written to the device
+    READ = 2,    // report read from the device
+    TIMEOUT = 3, // read that timed out
+    FAILURE = 4  // read or write that failed
+  };
+
+  Type type;
+  /// @brief Index into the device identities of the capture
+  uint8_t device;
+  /// @brief CMD2 << 8 | CMD3 of the message the report belongs to, 0 if
+  /// unknown. Replies are attributed through their sequence number.
+  uint16_t command;
+  /// @brief Time since the start of the recording
+  std::chrono::nanoseconds time;
+  /// @brief Number of bytes written or read
+  uint8_t size;
+  /// @brief Report without the report ID
+  std::array<uint8_t, packetSize> packet;
+};
+
+namespace internal {
+/// @brief Follows the messages written to and read from a device, telling
+/// header reports from continuations and remembering the command of every
+/// sequence number
+struct MessageTracker {
+  uint16_t command{0};
+  uint16_t continuation{0}; // bytes of the message still to be written
+  uint16_t replyCommand{0};
+  uint16_t replyContinuation{0}; // bytes of the reply still to be read
+  std::array<uint16_t, 256> commands{};
+
+  /// @brief Take a written report
+  /// @param packet Report without the report ID
+  /// @return True if the report starts a message
+  inline bool write(const uint8_t *packet) {
+    constexpr uint16_t firstBytes = packetSize - 4;
+    if (continuation > 0) {
+      continuation -= std::min<uint16_t>(continuation, packetSize);
+      return false;
+    }
+
+    uint16_t length = packet[2] | (packet[3] << 8);
+    command = packet[4] | (packet[5] << 8);
+    commands[packet[1]] = command;
+    continuation = length > firstBytes ? length - firstBytes : 0;
+    return true;
+  }
+
+  /// @brief Take a read report, replyCommand is the command it belongs to
+  /// @param packet Report without the report ID
+  /// @return True if the report starts a reply
+  inline bool read(const uint8_t *packet) {
+    constexpr uint16_t firstBytes = packetSize - 4;
+    if (replyContinuation > 0) {
+      replyContinuation -= std::min<uint16_t>(replyContinuation, packetSize);
+      return false;
+    }
+
+    uint16_t length = packet[2] | (packet[3] << 8);
+    replyCommand = commands[packet[1]];
+    replyContinuation = length > firstBytes ? length - firstBytes : 0;
+    return true;
+  }
+};
+}; // namespace internal
+
+/// @brief Writes every report sent and received by the devices to a binary
+/// log while installed with setRecorder.
+///
+/// The log starts with the magic "M350CAP" and a version byte. Each record
+/// starts with its type: 0 introduces a device (id, identity length,
+/// identity), the others are CaptureEntry types followed by the device id,
+/// the time in nanoseconds (8 bytes), the command (2 bytes), the size and
+/// the number of stored bytes, trailing zeros of the report are not stored.
+/// Multi-byte values are little endian.
+class Recorder {
+public:
+  Recorder() = default;
+  ~Recorder();
+
+  Recorder(const Recorder &) = delete;
+  Recorder &operator=(const Recorder &) = delete;
+
+  /// @brief Start a new log, replacing the file
+  /// @param file Path of the log
+  /// @return True on success
+  bool open(const std::string &file);
+
+  /// @brief Flush and close the log
+  void close();
+
+  /// @brief Record a report. Called by the devices.
+  /// @param device Device the report was exchanged with
+  /// @param type Direction or outcome
+  /// @param packet Report without the report ID, may be null if size is 0
+  /// @param size Number of bytes exchanged
+  void record(const Device &device, CaptureEntry::Type type,
+              const uint8_t *packet, size_t size);
+
+private:
+  struct DeviceState {
+    uint8_t id;
+    internal::MessageTracker messages;
+  };
+
+  DeviceState &getState(const Device &device);
+
+  std::ofstream stream;
+  std::chrono::steady_clock::time_point start;
+  std::map<const Device *, DeviceState> states;
+  std::mutex mutex;
+};
+
+/// @brief Install the recorder the devices report to. The recorder has to
+/// stay alive until it is replaced.
+/// @param recorder Recorder to use, nullptr to stop recording
+extern void setRecorder(Recorder *recorder);
+
+/// @brief Recorder currently installed
+/// @return Recorder, nullptr if not recording
+extern Recorder *getRecorder();
+
+/// @brief Captured session loaded from a log written by a Recorder
+class Capture {
+public:
+  /// @brief Load a log
+  /// @param file Path of the log
+  /// @return True on success
+  bool load(const std::string &file);
+
+  /// @brief Identities of the captured devices, indexed by device id
+  inline const std::vector<std::string> &getDevices() const { return devices; }
+
+  /// @brief Captured reports in the order they were exchanged
+  inline const std::vector<CaptureEntry> &getEntries() const {
+    return entries;
+  }
+
+  /// @brief Print where the time of the session went: round trips per
+  /// command with their count, total and maximum latency, per device
+  /// @param out Stream to print to
+  void printSummary(std::ostream &out) const;
+
+private:
+  std::vector<std::string> devices;
+  std::vector<CaptureEntry> entries;
+};
+
+/// @brief Transport playing back the reports of one device of a capture.
+/// Written reports are checked against the capture and replies are handed
+/// out with the latency they were captured with, so the time spent outside
+/// the device can be compared between runs.
+class ReplayTransport : public Transport {
+public:
+  /// @brief Play back a single captured device
+  /// @param _capture Loaded capture
+  /// @param identity Identity of the device in the capture
+  /// @param _realTime Wait for the captured latency before handing out a
+  /// reply, otherwise replies are available right away
+  ReplayTransport(std::shared_ptr<const Capture> _capture,
+                  const std::string &identity, bool _realTime = true);
+
+  inline bool isOpen() const override { return opened; }
+  inline void close() override { opened = false; }
+  inline const std::string &getPath() const override { return path; }
+  int32_t read(uint8_t *data, size_t size, int32_t timeout) override;
+  int32_t write(const uint8_t *data, size_t size) override;
+
+  /// @brief Number of written reports that differed from the capture
+  inline unsigned int getDivergences() const { return divergences; }
+
+private:
+  std::shared_ptr<const Capture> capture;
+  std::string path;
+  bool realTime;
+  std::atomic<bool> opened; // read by isOpen on other threads
+  std::vector<size_t> entries; // indices into the capture
+  size_t position;
+  std::chrono::nanoseconds capturedWrite;
+  std::chrono::steady_clock::time_point lastWrite;
+  unsigned int divergences;
+};
+}; // namespace USB
+}; // namespace multi350
+
+#endif
@@ -0,0 +1,526 @@
+#ifndef MULTI350_COMMANDS_HPP
+#define MULTI350_COMMANDS_HPP
+
+#include "dlpc350.hpp"
+#include "message.hpp"
+#include "pattern.hpp"
+#include "transport.hpp"
+#include <array>
+#include <cassert>
+#include <cstring>
+#include <mutex>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace multi350 {
+
+/// @brief Compile-time description of a DLPC350 command: its opcode, the
+/// layout of the parameters written and of the reply read back. Parameters
+/// are packed in order without padding, at offsets fixed at compile time.
+/// @tparam Opcode CMD2 << 8 | CMD3
+/// @tparam ReplyT Reply payload of a read, void if the command is write only
+/// @tparam ParamsT Parameters of a write, none if the command is read only
+template <uint16_t Opcode, typename ReplyT, typename... ParamsT>
+struct Descriptor {
+  using Reply = ReplyT;
+  using Params = std::tuple<ParamsT...>;
+
+  static constexpr uint16_t opcode = Opcode;
+  static constexpr uint8_t cmd2 = Opcode >> 8;
+  static constexpr uint8_t cmd3 = Opcode & 0xFF;
+
+  static constexpr bool readable = !std::is_void_v<ReplyT>;
+  static constexpr bool writable = sizeof...(ParamsT) > 0;
+
+  /// @brief Variable length payloads (LUTs) are sent up to paramSize bytes
+  static constexpr bool variable = false;
+
+  static constexpr size_t paramSize = (size_t{0} + ... + sizeof(ParamsT));
+  static constexpr size_t replySize = [] {
+    if constexpr (std::is_void_v<ReplyT>)
+      return size_t{0};
+    else
+      return sizeof(ReplyT);
+  }();
+
+  /// @brief Offset of every parameter in the message data, after the opcode
+  static constexpr std::array<size_t, sizeof...(ParamsT)> offsets = [] {
+    std::array<size_t, sizeof...(ParamsT)> result{};
+    size_t offset = sizeof(uint16_t);
+    size_t i = 0;
+    ((result[i++] = offset, offset += sizeof(ParamsT)), ...);
+    return result;
+  }();
+
+  static_assert((std::is_trivially_copyable_v<ParamsT> && ...),
+                "Parameters are copied to the wire as they are");
+  static_assert(sizeof(uint16_t) + paramSize <= internal::maxMessageDataSize,
+                "Parameters exceed the message size");
+  static_assert(replySize <= internal::maxMessageDataSize,
+                "Reply exceeds the message size");
+};
+
+namespace commands {
+struct HardwareStatus : Descriptor<0x1A0A, multi350::HardwareStatus> {
+  static constexpr const char *name = "HardwareStatus";
+};
+
+struct SystemStatus : Descriptor<0x1A0B, multi350::SystemStatus> {
+  static constexpr const char *name = "SystemStatus";
+};
+
+struct MainStatus : Descriptor<0x1A0C, multi350::MainStatus> {
+  static constexpr const char *name = "MainStatus";
+};
+
+struct Version : Descriptor<0x0205, std::array<uint32_t, 4>> {
+  static constexpr const char *name = "Version";
+};
+
+struct FirmwareTag : Descriptor<0x1AFF, std::array<char, 32>> {
+  static constexpr const char *name = "FirmwareTag";
+};
+
+// no reply, sent with sendNoAckMessage
+struct SoftwareReset : Descriptor<0x0802, void> {
+  static constexpr const char *name = "SoftwareReset";
+};
+
+struct PowerMode : Descriptor<0x0200, multi350::PowerMode, uint8_t> {
+  static constexpr const char *name = "PowerMode";
+};
+
+struct ColorCurtain : Descriptor<0x1100, std::array<uint16_t, 3>, uint16_t,
+                                 uint16_t, uint16_t> {
+  static constexpr const char *name = "ColorCurtain";
+};
+
+struct InputSource : Descriptor<0x1A00, multi350::InputSource, uint8_t> {
+  static constexpr const char *name = "InputSource";
+};
+
+struct TestPattern : Descriptor<0x1203, multi350::TestPattern, uint8_t> {
+  static constexpr const char *name = "TestPattern";
+};
+
+struct LEDEnable : Descriptor<0x1A07, multi350::LEDEnable, uint8_t> {
+  static constexpr const char *name = "LEDEnable";
+};
+
+// stored as 255 - current
+struct LEDCurrent
+    : Descriptor<0x0B01, multi350::LEDCurrent, uint8_t, uint8_t, uint8_t> {
+  static constexpr const char *name = "LEDCurrent";
+};
+
+struct DisplayMode : Descriptor<0x1A1B, multi350::DisplayMode, uint8_t> {
+  static constexpr const char *name = "DisplayMode";
+};
+
+struct GammaCorrection
+    : Descriptor<0x1A0E, multi350::GammaCorrection, uint8_t> {
+  static constexpr const char *name = "GammaCorrection";
+};
+
+// writing the dummy byte starts the validation
+struct PatternValidation
+    : Descriptor<0x1A1A, PatternSequenceValidation, uint8_t> {
+  static constexpr const char *name = "PatternValidation";
+};
+
+struct PatternTriggerMode
+    : Descriptor<0x1A23, multi350::PatternTriggerMode, uint8_t> {
+  static constexpr const char *name = "PatternTriggerMode";
+};
+
+struct PatternDataSource
+    : Descriptor<0x1A22, multi350::PatternDataSource, uint8_t> {
+  static constexpr const char *name = "PatternDataSource";
+};
+
+struct PatternStatus : Descriptor<0x1A24, multi350::PatternStatus, uint8_t> {
+  static constexpr const char *name = "PatternStatus";
+};
+
+struct PatternPeriod
+    : Descriptor<0x1A29, multi350::PatternPeriod, uint32_t, uint32_t> {
+  static constexpr const char *name = "PatternPeriod";
+};
+
+struct MailboxMode : Descriptor<0x1A33, void, uint8_t> {
+  static constexpr const char *name = "MailboxMode";
+};
+
+struct MailboxOffset : Descriptor<0x1A32, void, uint8_t> {
+  static constexpr const char *name = "MailboxOffset";
+};
+
+struct MailboxVarExpOffset : Descriptor<0x1A3F, void, uint16_t> {
+  static constexpr const char *name = "MailboxVarExpOffset";
+};
+
+struct PatternConfig
+    : Descriptor<0x1A31, void, uint8_t, uint8_t, uint8_t, uint8_t> {
+  static constexpr const char *name = "PatternConfig";
+};
+
+struct VarExpPatConfig
+    : Descriptor<0x1A40, void, uint16_t, uint16_t, uint8_t, uint8_t> {
+  static constexpr const char *name = "VarExpPatConfig";
+};
+
+// 3 bytes per pattern from the offset set with MailboxOffset, reads return
+// the configured patterns across several reports
+struct PatternLUT : Descriptor<0x1A34, std::array<uint8_t, maxPatterns * 3>,
+                               std::array<uint8_t, maxPatterns * 3>> {
+  static constexpr const char *name = "PatternLUT";
+  static constexpr bool variable = true;
+  static constexpr size_t entrySize = 3;
+};
+
+// 12 bytes per entry from the offset set with MailboxVarExpOffset
+struct VarExpPatLUT
+    : Descriptor<0x1A3E, void,
+                 std::array<uint8_t, (internal::maxMessageDataSize - 2) /
+                                         sizeof(VarExpPat) *
+                                         sizeof(VarExpPat)>> {
+  static constexpr const char *name = "VarExpPatLUT";
+  static constexpr bool variable = true;
+  static constexpr size_t entrySize = sizeof(VarExpPat);
+  static_assert(entrySize == 12, "Entries are sent as they are stored");
+};
+}; // namespace commands
+
+/// @brief Runtime entry of the command table, e.g. for tracing
+struct CommandInfo {
+  uint16_t opcode;
+  const char *name;
+  uint16_t paramSize; // maximum size if variable
+  uint16_t replySize;
+  bool readable;
+  bool writable;
+  bool variable;
+  USB::Deadline deadline; // of a write, reads are short
+};
+
+template <typename C> constexpr CommandInfo describe() {
+  return {C::opcode,   C::name,     C::paramSize,
+          C::replySize, C::readable, C::writable,
+          C::variable, getDeadline(C::opcode, Message::Type::WRITE)};
+}
+
+/// @brief All commands known to the library
+constexpr std::array commandTable{
+    describe<commands::HardwareStatus>(),
+    describe<commands::SystemStatus>(),
+    describe<commands::MainStatus>(),
+    describe<commands::Version>(),
+    describe<commands::FirmwareTag>(),
+    describe<commands::SoftwareReset>(),
+    describe<commands::PowerMode>(),
+    describe<commands::ColorCurtain>(),
+    describe<commands::InputSource>(),
+    describe<commands::TestPattern>(),
+    describe<commands::LEDEnable>(),
+    describe<commands::LEDCurrent>(),
+    describe<commands::DisplayMode>(),
+    describe<commands::GammaCorrection>(),
+    describe<commands::PatternValidation>(),
+    describe<commands::PatternTriggerMode>(),
+    describe<commands::PatternDataSource>(),
+    describe<commands::PatternStatus>(),
+    describe<commands::PatternPeriod>(),
+    describe<commands::MailboxMode>(),
+    describe<commands::MailboxOffset>(),
+    describe<commands::MailboxVarExpOffset>(),
+    describe<commands::PatternConfig>(),
+    describe<commands::VarExpPatConfig>(),
+    describe<commands::PatternLUT>(),
+    describe<commands::VarExpPatLUT>(),
+};
+
+static_assert(
+    [] {
+      for (size_t i = 0; i < commandTable.size(); ++i) {
+        for (size_t j = i + 1; j < commandTable.size(); ++j) {
+          if (commandTable[i].opcode == commandTable[j].opcode)
+            return false;
+        }
+      }
+      return true;
+    }(),
+    "Opcodes in the command table must be unique");
+
+// fixed layouts are sent and read in a single report, only the LUTs span
+// several
+static_assert(
+    [] {
+      constexpr size_t packetData = USB::packetSize - internal::headerSize;
+      for (auto &info : commandTable) {
+        if (info.variable)
+          continue;
+        if (sizeof(uint16_t) + info.paramSize > packetData ||
+            info.replySize > packetData)
+          return false;
+      }
+      return true;
+    }(),
+    "Fixed layout commands must fit a single report");
+
+/// @brief Look up a command by its opcode
+/// @param opcode CMD2 << 8 | CMD3
+/// @return Table entry, nullptr if the command is unknown
+constexpr const CommandInfo *findCommand(uint16_t opcode) {
+  for (auto &info : commandTable) {
+    if (info.opcode == opcode)
+      return &info;
+  }
+  return nullptr;
+}
+
+namespace internal {
+template <typename C, size_t... I, typename... Args>
+inline void pack(Message &msg, std::index_sequence<I...>, Args &&...args) {
+  (
+      [&msg](auto value) {
+        using Param = std::tuple_element_t<I, typename C::Params>;
+        Param param = static_cast<Param>(value);
+        memcpy(&msg.data[C::offsets[I]], &param, sizeof(Param));
+      }(std::forward<Args>(args)),
+      ...);
+  msg.length = static_cast<uint16_t>(sizeof(uint16_t) + C::paramSize);
+}
+
+template <typename C, size_t... I, typename... Args>
+inline void put(Encoder &encoder, std::index_sequence<I...>, Args &&...args) {
+  (encoder.put(static_cast<std::tuple_element_t<I, typename C::Params>>(
+       std::forward<Args>(args))),
+   ...);
+}
+}; // namespace internal
+
+/// @brief Build the write message of a command
+/// @tparam C Command descriptor
+/// @param params Parameters, converted to the types of the descriptor
+/// @return Message ready to be sent
+template <typename C, typename... Args>
+inline Message makeSetMessage(Args &&...params) {
+  static_assert(C::writable && !C::variable,
+                "Command takes no fixed parameters");
+  static_assert(sizeof...(Args) == std::tuple_size_v<typename C::Params>,
+                "Parameter count does not match the command");
+
+  auto msg = Message(Message::Type::WRITE, C::opcode);
+  internal::pack<C>(msg, std::index_sequence_for<Args...>{},
+                    std::forward<Args>(params)...);
+  return msg;
+}
+
+/// @brief Put an entry of a variable length command
+/// @tparam C Command descriptor
+/// @param encoder Encoder of a message of the command
+/// @param entry First C::entrySize bytes are put
+template <typename C>
+inline void addEntry(Encoder &encoder, const void *entry) {
+  static_assert(C::variable, "Command takes fixed parameters");
+  encoder.put(entry, C::entrySize);
+}
+
+/// @brief Write entries of a variable length command, encoding them straight
+/// into the out buffer of the device across as many reports as needed, and
+/// check that it was acknowledged
+/// @tparam C Command descriptor
+/// @param device Device to write to
+/// @param count Number of entries
+/// @param encode Called with the Encoder to put the entries with addEntry
+/// @return True on success
+template <typename C, typename Encode>
+inline bool setEntries(USB::Device &device, size_t count, Encode &&encode) {
+  static_assert(C::variable, "Command takes fixed parameters");
+  assert(count * C::entrySize <= C::paramSize);
+
+  std::lock_guard<std::mutex> lock(device.getMutex());
+  auto received = transactEncoded(
+      device, Message::Type::WRITE, C::opcode,
+      static_cast<uint16_t>(sizeof(uint16_t) + count * C::entrySize),
+      std::forward<Encode>(encode));
+  return static_cast<bool>(received);
+}
+
+/// @brief Read a command and copy its reply into a value
+/// @tparam C Command descriptor
+/// @param device Device to read from
+/// @param value Reply of the layout given by the descriptor
+/// @return True on success
+template <typename C>
+inline bool getCommand(USB::Device &device, typename C::Reply &value) {
+  static_assert(C::readable, "Command has no reply to read");
+  return sendGetMessage(device, C::opcode, value);
+}
+
+/// @brief Reason the last transaction on a device failed, told from the
+/// state it left the device in. Only call while still holding the device lock
+/// of the failed transaction, another transaction changes that state.
+/// @param device Device the transaction failed on
+/// @return Error of the transaction
+inline Error getError(USB::Device &device) {
+  if (!device.isOpen())
+    return Error::DISCONNECTED;
+  // the watchdog expires on a missing reply, any reply revives it
+  if (!device.isResponsive())
+    return Error::TIMEOUT;
+  return Error::DEVICE_ERROR;
+}
+
+/// @brief Read the reply of a command by value
+/// @tparam C Command descriptor
+/// @param device Device to read from
+/// @return Reply, or the reason it could not be read
+template <typename C>
+inline Result<typename C::Reply> readCommand(USB::Device &device) {
+  static_assert(C::readable, "Command has no reply to read");
+
+  typename C::Reply value{};
+  std::lock_guard<std::mutex> lock(device.getMutex());
+  auto received =
+      transactEncoded(device, Message::Type::READ, C::opcode,
+                      sizeof(uint16_t), [](Encoder &) {});
+  if (!received || !copyReply(device, received, value))
+    return std::unexpected(getError(device));
+  return value;
+}
+
+/// @brief Write a command, encoding the parameters straight into the out
+/// buffer of the device, and check that it was acknowledged
+/// @tparam C Command descriptor
+/// @param device Device to write to
+/// @param params Parameters, converted to the types of the descriptor
+/// @return True on success
+template <typename C, typename... Args>
+inline bool setCommand(USB::Device &device, Args &&...params) {
+  static_assert(C::writable && !C::variable,
+                "Command takes no fixed parameters");
+  static_assert(sizeof...(Args) == std::tuple_size_v<typename C::Params>,
+                "Parameter count does not match the command");
+
+  std::lock_guard<std::mutex> lock(device.getMutex());
+  auto received = transactEncoded(
+      device, Message::Type::WRITE, C::opcode,
+      sizeof(uint16_t) + C::paramSize, [&](Encoder &encoder) {
+        internal::put<C>(encoder, std::index_sequence_for<Args...>{},
+                         std::forward<Args>(params)...);
+      });
+  return static_cast<bool>(received);
+}
+
+/// @brief Writes a burst of set commands back to back on a pipeline and
+/// checks their acknowledgements afterwards, instead of waiting for every ack
+/// before writing the next command. The device applies the commands in
+/// order, a failing command does not stop the ones behind it. Holds the
+/// device lock while alive.
+class Batch {
+public:
+  explicit Batch(USB::Device &device) : pipeline{device} {}
+  ~Batch() { commit(); }
+
+  Batch(const Batch &) = delete;
+  Batch &operator=(const Batch &) = delete;
+
+  /// @brief Write a command without waiting for its ack
+  /// @tparam C Command descriptor
+  /// @param params Parameters, converted to the types of the descriptor
+  template <typename C, typename... Args> inline void set(Args &&...params) {
+    static_assert(C::writable && !C::variable,
+                  "Command takes no fixed parameters");
+    static_assert(sizeof...(Args) == std::tuple_size_v<typename C::Params>,
+                  "Parameter count does not match the command");
+
+    reserve();
+    add(C::name, pipeline.postEncoded(
+                     Message::Type::WRITE, C::opcode,
+                     sizeof(uint16_t) + C::paramSize, [&](Encoder &encoder) {
+                       internal::put<C>(encoder,
+                                        std::index_sequence_for<Args...>{},
+                                        std::forward<Args>(params)...);
+                     }));
+  }
+
+  /// @brief Write entries of a variable length command without waiting for
+  /// its ack
+  /// @tparam C Command descriptor
+  /// @param count Number of entries
+  /// @param encode Called with the Encoder to put the entries with addEntry
+  template <typename C, typename Encode>
+  inline void setEntries(size_t count, Encode &&encode) {
+    static_assert(C::variable, "Command takes fixed parameters");
+    assert(count * C::entrySize <= C::paramSize);
+
+    reserve();
+    add(C::name,
+        pipeline.postEncoded(
+            Message::Type::WRITE, C::opcode,
+            static_cast<uint16_t>(sizeof(uint16_t) + count * C::entrySize),
+            std::forward<Encode>(encode)));
+  }
+
+  /// @brief Collect the acks of every command written so far
+  /// @return True if all commands of the batch were acknowledged
+  inline bool commit() {
+    while (!pending.empty()) {
+      collect();
+    }
+    return failed < 0;
+  }
+
+  /// @brief Position of the first failed command in the batch
+  /// @return Position counted from 0, -1 if none failed
+  inline int getFailed() const { return failed; }
+
+  /// @brief Name of the first failed command in the batch
+  /// @return Name from the command table, nullptr if none failed
+  inline const char *getFailedName() const { return failedName; }
+
+  /// @brief Device the batch writes to, locked while the batch is alive
+  inline USB::Device &getDevice() { return pipeline.getDevice(); }
+
+private:
+  struct Entry {
+    Pipeline::Ticket ticket;
+    int position;
+    const char *name;
+  };
+
+  // acks are collected early once the window is full
+  inline void reserve() {
+    if (pending.size() == Pipeline::window)
+      collect();
+  }
+
+  inline void add(const char *name, Pipeline::Ticket ticket) {
+    pending.push({ticket, count++, name});
+  }
+
+  inline void collect() {
+    auto entry = pending.front();
+    pending.pop();
+    if (pipeline.wait(entry.ticket))
+      return;
+
+    // what the device holds after a failed write is unknown
+    pipeline.getDevice().getUploadRecord().clear();
+    if (failed < 0) {
+      failed = entry.position;
+      failedName = entry.name;
+    }
+  }
+
+  Pipeline pipeline;
+  USB::RingBuffer<Entry, Pipeline::window> pending;
+  int count{0};
+  int failed{-1};
+  const char *failedName{nullptr};
+};
+}; // namespace multi350
+
+#endif
@@ -1,12 +1,21 @@
 #ifndef MULTI350_CONTROLLER_HPP
 #define MULTI350_CONTROLLER_HPP
 
+#include "coroutine.hpp"
 #include "dlpc350.hpp"
+#include "identity.hpp"
 #include "message.hpp"
+#include "monitor.hpp"
 #include "pattern.hpp"
 #include "status.hpp"
+#include "transport.hpp"
 #include "usb.hpp"
+#include <chrono>
 #include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 
 namespace multi350 {
@@ -18,6 +27,7 @@ constexpr unsigned int maxRetries = 10;
 struct Projector {
   unsigned int index;
   bool controlled{true};
+  bool connected{true};
   PowerMode powerMode;
   LEDCurrent ledCurrent;
   DisplayMode displayMode;
@@ -27,6 +37,13 @@ struct Projector {
   SystemStatus systemStatus;
   MainStatus mainStatus;
 
+  // round trip of the last state read by sync or snapshot
+  std::chrono::microseconds snapshotLatency{0};
+
+  // last started sequence, replayed when the projector reconnects
+  std::shared_ptr<PatternSequence> patternSequence;
+  std::shared_ptr<VarExpPatSequence> varExpPatSequence;
+
   Projector()
       : index{0}, powerMode{PowerMode::NORMAL}, ledCurrent{0},
         displayMode{DisplayMode::VIDEO}, patternStatus(PatternStatus::STOP) {}
@@ -47,9 +64,23 @@ struct Controller {
   /// @return True on success
   inline bool exit() { return USB::exit(); }
 
+  /// @brief Keep the projector order in a file. Projectors found in it are
+  /// opened at their stored index, the file is updated whenever the order
+  /// changes. Call before open.
+  /// @param file Path of the identity map file, created if missing
+  /// @return False if the file exists but could not be read
+  bool setIdentityFile(const std::string &file);
+
   /// @brief Open USB connections to connected DLPC350 devices
+  /// @param backend Backend used to open the devices
   /// @return True on success
-  bool open();
+  bool open(USB::Backend backend = USB::Backend::HIDAPI);
+
+  /// @brief Open DLPC350 devices connected through the given transports, e.g.
+  /// loopback transports when no projector is attached
+  /// @param transports Opened transports, one per device
+  /// @return True on success
+  bool open(std::vector<std::unique_ptr<USB::Transport>> transports);
 
   /// @brief Close all USB connections to DLPC350 devices
   void close();
@@ -57,6 +88,25 @@ struct Controller {
   /// @brief Sync the controller with the projectors
   void sync();
 
+  /// @brief Start watching for projectors being plugged in and out. Only the
+  /// affected projector is opened or closed, new ones are appended to the
+  /// projector list. Projectors that fail or come back are reconnected in the
+  /// background and their last known state is replayed.
+  /// @param backend Backend used to enumerate and open the devices
+  /// @return True on success
+  bool startMonitor(USB::Backend backend = USB::Backend::HIDAPI);
+
+  /// @brief Start watching for projectors through custom enumeration, e.g. a
+  /// simulated bus
+  /// @param enumerator Lists the paths of the connected devices
+  /// @param opener Opens a device by its path
+  /// @return True on success
+  bool startMonitor(USB::Monitor::Enumerator enumerator,
+                    USB::Monitor::Opener opener);
+
+  /// @brief Stop watching for projectors
+  void stopMonitor();
+
   /// @brief Check if there are connected DLPC350 devices
   /// @return True if there is at least one device connected
   inline bool isConnected() { return USB::isConnected(); }
@@ -81,14 +131,23 @@ struct Controller {
   void controlSingle(unsigned int index);
 
   // TODO: change to a swap to match imgui function?
+  /// @brief Reassign the devices of the projectors, stored in the identity
+  /// file if one is set
   bool updateIndices(const std::vector<unsigned int> &indices);
 
   /// @brief Perform software reset on all controlled projectors
   /// @return True on success
   bool softwareReset();
 
-  /// @brief Update hardware/main/system status of the projectors
-  void updateStatus();
+  /// @brief Read the full state of the controlled projectors. Each projector
+  /// is read in a single pipelined round trip, in parallel with the others.
+  /// @return True if every available projector was read
+  bool snapshot();
+
+  /// @brief Update hardware/main/system status of the projectors. The status
+  /// of a projector that fails to reply is left as it was.
+  /// @return True if the status of every available projector was read
+  bool updateStatus();
 
   /// @brief Set power mode on projectors. Waits 2000ms to finish switching.
   /// @param powerMode STANDBY(true) / NORMAL(false)
@@ -151,6 +210,30 @@ struct Controller {
   /// @return True on success
   bool setLEDCurrent(unsigned int index, LEDCurrent ledCurrent);
 
+  /// @brief Awaitable setDisplayMode. The controlled projectors switch
+  /// concurrently when run on a Scheduler.
+  /// @param displayMode PATTERN(true) / VIDEO(false)
+  /// @return Task returning true on success
+  Task<bool> setDisplayModeAsync(DisplayMode displayMode);
+
+  /// @brief Awaitable startPatternSequence. The controlled projectors are
+  /// configured concurrently when run on a Scheduler.
+  /// @param patternSequence Reference to pattern sequence object, must outlive
+  /// the task
+  /// @return Task returning true on success
+  Task<bool> startPatternSequenceAsync(PatternSequence &patternSequence);
+
+  /// @brief Awaitable startVarExpPatSequence. The controlled projectors are
+  /// configured concurrently when run on a Scheduler.
+  /// @param varExpPatSequence Reference to variable exposure pattern sequence
+  /// object, must outlive the task
+  /// @return Task returning true on success
+  Task<bool> startVarExpPatSequenceAsync(VarExpPatSequence &varExpPatSequence);
+
+  /// @brief Awaitable stopPatternSequence
+  /// @return Task returning true on success
+  Task<bool> stopPatternSequenceAsync();
+
   /// @brief Prints all list of connected devices
   inline void printDevices() { USB::printDevices(); }
 
@@ -160,47 +243,150 @@ struct Controller {
   // void showVersion();
 
 protected:
-  /// @brief Set which DLPC350 device is currently getting controlled by the
-  /// HIDAPI library. Only needed for manually configuring a single specific
-  /// projector.
-  /// @param index Index of the projector (Should be less than deviceNum())
+  /// @brief Create the projector list for the opened devices and sync it
   /// @return True on success
-  inline bool select(unsigned int index) { return USB::select(index); }
+  bool setupProjectors();
+
+  /// @brief Record the identity of every projector at its index and store
+  /// the map if an identity file is set
+  void storeIdentities();
+
+  /// @brief Read back the state of a single projector in one pipelined
+  /// round trip. Nothing is changed unless all of it was read.
+  /// @param projector Projector to sync
+  /// @return True on success
+  bool syncSingle(Projector &projector);
+
+  /// @brief Check if the device of a projector is open. Marks the projector
+  /// disconnected otherwise, so operations skip it instead of failing the
+  /// whole array.
+  /// @param projector Projector to check
+  /// @return True if the projector can be driven
+  bool isAvailable(Projector &projector);
+
+  /// @brief Restore the last known state of a reconnected projector: power
+  /// mode, LED current and display mode or the running pattern sequence.
+  /// Called without the mutex, on a copy of the projector.
+  /// @param projector Projector to restore
+  /// @return True on success
+  bool replaySingle(Projector &projector);
+
+  /// @brief Apply a hot-plug event. Called from the monitor thread.
+  /// @param event Change of the device slot
+  /// @param index Index of the device slot
+  void onDeviceEvent(USB::DeviceEvent event, unsigned int index);
 
   /// @brief Set display mode for a single projector.
+  /// @param device Device handle of the projector
   /// @param displayMode PATTERN(true) / VIDEO(false)
   /// @return True on success
-  bool setDisplayModeSingle(DisplayMode displayMode);
+  bool setDisplayModeSingle(USB::Device &device, DisplayMode displayMode);
 
   /// @brief Start pattern sequence on a single projector. Should create
   /// necessary pattern sequence object and add patterns prior to calling this
   /// function.
+  /// @param device Device handle of the projector
   /// @param patternSequence  Reference to pattern sequence object
   /// @return True on success
-  bool startPatternSequenceSingle(PatternSequence &patternSequence);
+  bool startPatternSequenceSingle(USB::Device &device,
+                                  PatternSequence &patternSequence);
 
   /// @brief Start variable exposure pattern sequence on a single projector.
   /// Should create necessary variable exposure pattern sequence objects prior
   /// to calling this function.
+  /// @param device Device handle of the projector
   /// @param varExpPatSequence  Reference to variable exposure pattern sequence
   /// object
   /// @return True on success
-  bool startVarExpPatSequenceSingle(VarExpPatSequence &varExpPatSequence);
+  bool startVarExpPatSequenceSingle(USB::Device &device,
+                                    VarExpPatSequence &varExpPatSequence);
+
+  /// @brief Write the configuration and LUT of a pattern sequence to a
+  /// single projector in one burst, the acks are checked afterwards. Only
+  /// what differs from the validated sequence the device holds is written.
+  /// @param device Device handle of the projector
+  /// @param patternSequence Reference to pattern sequence object
+  /// @param changed Set to true if anything was written, the sequence then
+  /// has to be validated
+  /// @return True on success
+  bool configurePatternSequenceSingle(USB::Device &device,
+                                      PatternSequence &patternSequence,
+                                      bool &changed);
+
+  /// @brief Write the configuration and LUT of a variable exposure pattern
+  /// sequence to a single projector in one burst, the acks are checked
+  /// afterwards. Only what differs from the validated sequence the device
+  /// holds is written.
+  /// @param device Device handle of the projector
+  /// @param varExpPatSequence Reference to variable exposure pattern sequence
+  /// object
+  /// @param changed Set to true if anything was written, the sequence then
+  /// has to be validated
+  /// @return True on success
+  bool configureVarExpPatSequenceSingle(USB::Device &device,
+                                        VarExpPatSequence &varExpPatSequence,
+                                        bool &changed);
 
   /// @brief Validate the current pattern configured on the DLPC350. Expects the
   /// pattern data and the related configuration to be already set.
+  /// @param device Device handle of the projector
   /// @return True on success
-  bool validatePatternSequenceSingle();
+  bool validatePatternSequenceSingle(USB::Device &device);
 
   /// @brief Start/Stop the pattern sequence. Expects the pattern sequence to be
   /// validated before calling this function.
+  /// @param device Device handle of the projector
   /// @param psStatus PatternStatus object indicating start/stop
   /// @return True on success
-  bool setPatternStatusSingle(PatternStatus psStatus);
+  bool setPatternStatusSingle(USB::Device &device, PatternStatus psStatus);
+
+  /// @brief Awaitable versions of the single projector flows. Waits are
+  /// coroutine sleeps, so flows on several projectors interleave on one
+  /// thread. Projectors are addressed by their device index, as they may be
+  /// rebuilt while a flow is suspended. On success, the state of the
+  /// projector is updated if it is still there.
+  Task<bool> setDisplayModeSingleAsync(unsigned int index,
+                                       DisplayMode displayMode);
+  Task<bool> startPatternSequenceSingleAsync(unsigned int index,
+                                             PatternSequence &patternSequence);
+  Task<bool>
+  startVarExpPatSequenceSingleAsync(unsigned int index,
+                                    VarExpPatSequence &varExpPatSequence);
+  Task<bool> validatePatternSequenceSingleAsync(USB::Device &device);
+  Task<bool> setPatternStatusSingleAsync(USB::Device &device,
+                                         PatternStatus psStatus);
+
+  /// @brief Projector driving the device at an index. Only call while
+  /// holding the mutex.
+  /// @param index Device index of the projector
+  /// @return Projector, nullptr if there is none anymore
+  Projector *findProjector(unsigned int index);
+
+  /// @brief Change the state of a projector while holding the mutex, for
+  /// flows that suspend between their I/O
+  /// @param index Device index of the projector
+  /// @param apply Called with the projector if it is still there
+  template <typename Apply>
+  inline void updateProjector(unsigned int index, Apply &&apply) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    if (auto *projector = Controller::findProjector(index))
+      apply(*projector);
+  }
 
   /// @brief Contains information of connected projectors and the corresponding
-  /// index for the USB interface.
-  std::vector<Projector> projectors;
+  /// index for the USB interface. A deque so that references stay valid while
+  /// the hot-plug monitor appends projectors.
+  std::deque<Projector> projectors;
+
+  /// @brief Guards the projectors against the hot-plug monitor
+  std::recursive_mutex mutex;
+
+  /// @brief Logical index of every known device, kept in identityFile
+  IdentityMap identities;
+  std::string identityFile;
+
+  /// @brief Hot-plug monitor, if started
+  std::unique_ptr<USB::Monitor> monitor;
 };
 
 }; // namespace multi350
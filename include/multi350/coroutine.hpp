@@ -0,0 +1,223 @@
+#ifndef MULTI350_COROUTINE_HPP
+#define MULTI350_COROUTINE_HPP
+
+#include "async.hpp"
+#include "usb.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace multi350 {
+
+namespace internal {
+/// @brief Shared completion state of the tasks awaited by whenAll
+struct Join {
+  size_t remaining;
+  std::coroutine_handle<> parent;
+};
+}; // namespace internal
+
+/// @brief Lazily started coroutine producing a value. Awaiting a task starts
+/// it and resumes the awaiting coroutine once it returns.
+template <typename T> class Task {
+public:
+  struct promise_type;
+  using Handle = std::coroutine_handle<promise_type>;
+
+  struct promise_type {
+    T value{};
+    std::coroutine_handle<> continuation;
+    internal::Join *join{nullptr};
+
+    Task get_return_object() { return Task(Handle::from_promise(*this)); }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct FinalAwaiter {
+      bool await_ready() noexcept { return false; }
+      std::coroutine_handle<> await_suspend(Handle handle) noexcept {
+        auto &promise = handle.promise();
+        if (promise.continuation)
+          return promise.continuation;
+        if (promise.join && --promise.join->remaining == 0)
+          return promise.join->parent;
+        return std::noop_coroutine();
+      }
+      void await_resume() noexcept {}
+    };
+
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void return_value(T _value) { value = std::move(_value); }
+    void unhandled_exception() { std::abort(); }
+  };
+
+  explicit Task(Handle _handle) : handle{_handle} {}
+  Task(Task &&other) noexcept : handle{std::exchange(other.handle, {})} {}
+  Task &operator=(Task &&other) noexcept {
+    if (this != &other) {
+      if (handle)
+        handle.destroy();
+      handle = std::exchange(other.handle, {});
+    }
+    return *this;
+  }
+  ~Task() {
+    if (handle)
+      handle.destroy();
+  }
+
+  Task(const Task &) = delete;
+  Task &operator=(const Task &) = delete;
+
+  /// @brief Check if the task has returned
+  inline bool isDone() const { return handle && handle.done(); }
+
+  /// @brief Value returned by the task, only valid once done
+  inline T &getResult() { return handle.promise().value; }
+
+  inline Handle getHandle() const { return handle; }
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) {
+    handle.promise().continuation = awaiting;
+    return handle;
+  }
+  T await_resume() { return std::move(handle.promise().value); }
+
+private:
+  Handle handle;
+};
+
+/// @brief Single threaded event loop resuming coroutines. Coroutines awaiting
+/// device I/O are resumed here once their device worker has completed, so the
+/// multi-step flows of many projectors interleave on one thread.
+class Scheduler {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  /// @brief Run a task and every coroutine it spawns on the calling thread
+  /// @param task Task to run
+  /// @return Value returned by the task
+  template <typename T> T run(Task<T> task) {
+    auto *previous = std::exchange(active, this);
+    schedule(task.getHandle());
+    while (!task.isDone()) {
+      step();
+    }
+    active = previous;
+    return std::move(task.getResult());
+  }
+
+  /// @brief Resume a coroutine on the scheduler thread. Safe to call from any
+  /// thread.
+  void schedule(std::coroutine_handle<> handle);
+
+  /// @brief Resume a coroutine on the scheduler thread at a point in time.
+  /// Only called from the scheduler thread.
+  void scheduleAt(Clock::time_point time, std::coroutine_handle<> handle);
+
+  /// @brief Scheduler running on the calling thread
+  static Scheduler &current();
+
+private:
+  void step();
+
+  static thread_local Scheduler *active;
+
+  std::deque<std::coroutine_handle<>> ready;
+  std::multimap<Clock::time_point, std::coroutine_handle<>> timers;
+  std::mutex mutex;
+  std::condition_variable condition;
+};
+
+/// @brief Awaitable suspending the coroutine for a duration
+struct SleepAwaiter {
+  Scheduler::Clock::duration duration;
+
+  bool await_ready() const noexcept { return duration.count() <= 0; }
+  void await_suspend(std::coroutine_handle<> handle) {
+    Scheduler::current().scheduleAt(Scheduler::Clock::now() + duration,
+                                    handle);
+  }
+  void await_resume() noexcept {}
+};
+
+/// @brief Suspend the coroutine without blocking the scheduler thread
+template <typename Rep, typename Period>
+inline SleepAwaiter sleepFor(std::chrono::duration<Rep, Period> duration) {
+  return {std::chrono::duration_cast<Scheduler::Clock::duration>(duration)};
+}
+
+/// @brief Awaitable running a blocking function on the I/O thread of a device
+template <typename Function> class CallAwaiter {
+public:
+  using Result = std::invoke_result_t<Function>;
+
+  CallAwaiter(USB::Device &_device, Function _function)
+      : device{_device}, function{std::move(_function)} {}
+
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> handle) {
+    auto *scheduler = &Scheduler::current();
+    device.getWorker().execute([this, scheduler, handle] {
+      result = function();
+      scheduler->schedule(handle);
+    });
+  }
+  Result await_resume() { return std::move(result); }
+
+private:
+  USB::Device &device;
+  Function function;
+  Result result{};
+};
+
+/// @brief Await a blocking command, e.g. `co_await call(device, [&] {
+/// return setDisplayMode(device, mode); })`
+template <typename Function>
+inline CallAwaiter<Function> call(USB::Device &device, Function function) {
+  return CallAwaiter<Function>(device, std::move(function));
+}
+
+/// @brief Awaitable running several tasks concurrently
+class WhenAll {
+public:
+  explicit WhenAll(std::vector<Task<bool>> &_tasks)
+      : tasks{_tasks}, join{0, nullptr} {}
+
+  bool await_ready() const noexcept { return tasks.empty(); }
+  void await_suspend(std::coroutine_handle<> handle) {
+    join = {tasks.size(), handle};
+    auto &scheduler = Scheduler::current();
+    for (auto &task : tasks) {
+      task.getHandle().promise().join = &join;
+      scheduler.schedule(task.getHandle());
+    }
+  }
+  bool await_resume() {
+    bool result = true;
+    for (auto &task : tasks) {
+      result = task.getResult() && result;
+    }
+    return result;
+  }
+
+private:
+  std::vector<Task<bool>> &tasks;
+  internal::Join join;
+};
+
+/// @brief Run tasks concurrently and wait for all of them
+/// @return Awaitable returning true if every task returned true
+inline WhenAll whenAll(std::vector<Task<bool>> &tasks) {
+  return WhenAll(tasks);
+}
+}; // namespace multi350
+
+#endif
@@ -2,7 +2,9 @@
 #define MULTI350_DLPC350_HPP
 
 #include "pattern.hpp"
+#include <chrono>
 #include <cstdint>
+#include <expected>
 #include <memory>
 #include <string>
 
@@ -226,74 +228,169 @@ enum class MailboxMode : uint8_t {
   VAR_EXPOSURE_PATTERN = 3 // Open mailbox for var exposure pattern definition
 };
 
-// TODO: convert unique_ptr to regular data return type?
+class Batch;
+
+/// @brief Reason a command failed
+enum class Error : uint8_t {
+  TIMEOUT,      // no reply within the deadline of the command
+  DEVICE_ERROR, // reply flagged as an error, or not understood
+  DISCONNECTED  // transport of the device closed
+};
+
+/// @brief Name of an error for logging
+constexpr const char *getErrorName(Error error) {
+  switch (error) {
+  case Error::TIMEOUT:
+    return "timeout";
+  case Error::DEVICE_ERROR:
+    return "device error";
+  default:
+    return "disconnected";
+  }
+}
+
+/// @brief Value read from a device, or the reason it could not be read
+template <typename T> using Result = std::expected<T, Error>;
+
+/// @brief Hardware, system and main status, read in a single round trip
+struct StatusRegisters {
+  HardwareStatus hardware;
+  SystemStatus system;
+  MainStatus main;
+};
+
+/// @brief Full state of a projector, read in a single pipelined round trip
+struct Snapshot {
+  PowerMode powerMode;
+  LEDCurrent ledCurrent;
+  DisplayMode displayMode;
+  PatternStatus patternStatus;
+  HardwareStatus hardwareStatus;
+  SystemStatus systemStatus;
+  MainStatus mainStatus;
+  /// @brief Time from the first request to the last reply
+  std::chrono::microseconds latency;
+};
+
+/// Value returning getters. Nothing is allocated and a failed read returns
+/// the reason instead of a null pointer.
+Result<HardwareStatus> readHardwareStatus(USB::Device &device);
+Result<SystemStatus> readSystemStatus(USB::Device &device);
+Result<MainStatus> readMainStatus(USB::Device &device);
+Result<StatusRegisters> readStatus(USB::Device &device);
+Result<Snapshot> readSnapshot(USB::Device &device);
+Result<Version> readVersion(USB::Device &device);
+Result<std::string> readFirmwareTag(USB::Device &device);
+Result<PowerMode> readPowerMode(USB::Device &device);
+Result<CurtainColor> readColorCurtain(USB::Device &device);
+Result<InputSource> readInputSource(USB::Device &device);
+Result<TestPattern> readTestPattern(USB::Device &device);
+Result<LEDEnable> readLEDEnable(USB::Device &device);
+Result<LEDCurrent> readLEDCurrent(USB::Device &device);
+Result<DisplayMode> readDisplayMode(USB::Device &device);
+Result<GammaCorrection> readGammaCorrection(USB::Device &device);
+Result<PatternSequenceValidation> readPatternValidation(USB::Device &device);
+Result<PatternTriggerMode> readPatternTriggerMode(USB::Device &device);
+Result<PatternDataSource> readPatternDataSource(USB::Device &device);
+Result<PatternStatus> readPatternStatus(USB::Device &device);
+Result<PatternPeriod> readPatternPeriod(USB::Device &device);
 
 /// Status Commands
-std::unique_ptr<HardwareStatus> getHardwareStatus();
-std::unique_ptr<SystemStatus> getSystemStatus();
-std::unique_ptr<MainStatus> getMainStatus();
-std::unique_ptr<Version> getVersion();
-std::unique_ptr<std::string> getFirmwareTag();
+std::unique_ptr<HardwareStatus> getHardwareStatus(USB::Device &device);
+std::unique_ptr<SystemStatus> getSystemStatus(USB::Device &device);
+std::unique_ptr<MainStatus> getMainStatus(USB::Device &device);
+bool getHardwareStatus(USB::Device &device, HardwareStatus &status);
+bool getSystemStatus(USB::Device &device, SystemStatus &status);
+bool getMainStatus(USB::Device &device, MainStatus &status);
+bool getStatus(USB::Device &device, HardwareStatus &hardwareStatus,
+               SystemStatus &systemStatus, MainStatus &mainStatus);
+std::unique_ptr<Version> getVersion(USB::Device &device);
+std::unique_ptr<std::string> getFirmwareTag(USB::Device &device);
 
 /// Chipset Control Commands
-bool softwareReset();
+bool softwareReset(USB::Device &device);
 
-std::unique_ptr<PowerMode> getPowerMode();
-bool setPowerMode(PowerMode mode);
+std::unique_ptr<PowerMode> getPowerMode(USB::Device &device);
+bool setPowerMode(USB::Device &device, PowerMode mode);
 
-std::unique_ptr<CurtainColor> getColorCurtain();
-bool setColorCurtain(uint16_t red, uint16_t green, uint16_t blue);
+std::unique_ptr<CurtainColor> getColorCurtain(USB::Device &device);
+bool setColorCurtain(USB::Device &device, uint16_t red, uint16_t green,
+                     uint16_t blue);
 
-std::unique_ptr<InputSource> getInputSource();
-bool setInputSource(InputType type,
+std::unique_ptr<InputSource> getInputSource(USB::Device &device);
+bool setInputSource(USB::Device &device, InputType type,
                     InputBitDepth bitDepth = InputBitDepth::INTERNAL);
 
-std::unique_ptr<TestPattern> getTestPattern();
-bool setTestPattern(TestPattern pattern);
+std::unique_ptr<TestPattern> getTestPattern(USB::Device &device);
+bool setTestPattern(USB::Device &device, TestPattern pattern);
 
-std::unique_ptr<LEDEnable> getLEDEnable();
-bool setLEDEnable(LEDEnableMode mode, bool redEnabled = true,
-                  bool greenEnabled = true, bool blueEnabled = true);
+std::unique_ptr<LEDEnable> getLEDEnable(USB::Device &device);
+bool setLEDEnable(USB::Device &device, LEDEnableMode mode,
+                  bool redEnabled = true, bool greenEnabled = true,
+                  bool blueEnabled = true);
 
-std::unique_ptr<LEDCurrent> getLEDCurrent();
-bool setLEDCurrent(uint8_t red, uint8_t green, uint8_t blue);
+std::unique_ptr<LEDCurrent> getLEDCurrent(USB::Device &device);
+bool setLEDCurrent(USB::Device &device, uint8_t red, uint8_t green,
+                   uint8_t blue);
 
 /// Display Sequences
-std::unique_ptr<DisplayMode> getDisplayMode();
-bool setDisplayMode(DisplayMode mode);
+std::unique_ptr<DisplayMode> getDisplayMode(USB::Device &device);
+bool setDisplayMode(USB::Device &device, DisplayMode mode);
 
-std::unique_ptr<GammaCorrection> getGammaCorrection();
-bool setGammaCorrection(bool enable, bool degammaTable = false);
+std::unique_ptr<GammaCorrection> getGammaCorrection(USB::Device &device);
+bool setGammaCorrection(USB::Device &device, bool enable,
+                        bool degammaTable = false);
 
-std::unique_ptr<PatternSequenceValidation> startPatternValidation();
-std::unique_ptr<PatternSequenceValidation> checkPatternValidation();
+std::unique_ptr<PatternSequenceValidation>
+startPatternValidation(USB::Device &device);
+std::unique_ptr<PatternSequenceValidation>
+checkPatternValidation(USB::Device &device);
 
-std::unique_ptr<PatternTriggerMode> getPatternTriggerMode();
-bool setPatternTriggerMode(PatternTriggerMode mode);
+std::unique_ptr<PatternTriggerMode> getPatternTriggerMode(USB::Device &device);
+bool setPatternTriggerMode(USB::Device &device, PatternTriggerMode mode);
 
-std::unique_ptr<PatternDataSource> getPatternDataSource();
-bool setPatternDataSource(PatternDataSource input);
+std::unique_ptr<PatternDataSource> getPatternDataSource(USB::Device &device);
+bool setPatternDataSource(USB::Device &device, PatternDataSource input);
 
-std::unique_ptr<PatternStatus> getPatternStatus();
-bool setPatternStatus(PatternStatus mode);
+std::unique_ptr<PatternStatus> getPatternStatus(USB::Device &device);
+bool setPatternStatus(USB::Device &device, PatternStatus mode);
 
-std::unique_ptr<PatternPeriod> getPatternPeriod();
-bool setPatternPeriod(uint32_t exposure, uint32_t frame);
+std::unique_ptr<PatternPeriod> getPatternPeriod(USB::Device &device);
+bool setPatternPeriod(USB::Device &device, uint32_t exposure, uint32_t frame);
+void setPatternPeriod(Batch &batch, uint32_t exposure, uint32_t frame);
 
-bool setMailboxMode(MailboxMode mode);
+bool setMailboxMode(USB::Device &device, MailboxMode mode);
 
-bool setMailboxOffset(uint8_t offset);
-bool setMailboxVarExpOffset(uint16_t offset);
+bool setMailboxOffset(USB::Device &device, uint8_t offset);
+bool setMailboxVarExpOffset(USB::Device &device, uint16_t offset);
 
-bool configurePatternSequence(PatternSequence &patternSequence,
+bool configurePatternSequence(USB::Device &device,
+                              PatternSequence &patternSequence,
+                              bool repeat = true,
+                              uint8_t patternNumPerTrigOut2 = 1);
+void configurePatternSequence(Batch &batch, PatternSequence &patternSequence,
                               bool repeat = true,
                               uint8_t patternNumPerTrigOut2 = 1);
-bool configureVarExpPatSequence(VarExpPatSequence &varExpPatSequence,
+bool configureVarExpPatSequence(USB::Device &device,
+                                VarExpPatSequence &varExpPatSequence,
+                                bool repeat = true,
+                                uint16_t varExpPatNumPerTrigOut2 = 1);
+void configureVarExpPatSequence(Batch &batch,
+                                VarExpPatSequence &varExpPatSequence,
                                 bool repeat = true,
                                 uint16_t varExpPatNumPerTrigOut2 = 1);
 
-bool sendPatternDisplayLUT(PatternSequence &patternSequence);
-bool sendVarExpPatDisplayLUT(VarExpPatSequence &varExpPatSequence);
+// only the entries changed since the last upload to the device are sent, the
+// Batch versions return false if there were none
+bool sendPatternDisplayLUT(USB::Device &device,
+                           PatternSequence &patternSequence);
+bool sendPatternDisplayLUT(Batch &batch, PatternSequence &patternSequence);
+bool getPatternDisplayLUT(USB::Device &device,
+                          PatternSequence &patternSequence);
+bool sendVarExpPatDisplayLUT(USB::Device &device,
+                             VarExpPatSequence &varExpPatSequence);
+bool sendVarExpPatDisplayLUT(Batch &batch,
+                             VarExpPatSequence &varExpPatSequence);
 
 }; // namespace multi350
 
@@ -0,0 +1,211 @@
+#ifndef MULTI350_DLPC350_ASYNC_HPP
+#define MULTI350_DLPC350_ASYNC_HPP
+
+#include "coroutine.hpp"
+#include "dlpc350.hpp"
+
+/// Awaitable versions of the DLPC350 commands. Each command runs on the I/O
+/// thread of its device and resumes the awaiting coroutine on its scheduler,
+/// e.g. `bool result = co_await setDisplayModeAsync(device, mode);`
+
+namespace multi350 {
+
+/// Status Commands
+inline auto getHardwareStatusAsync(USB::Device &device) {
+  return call(device, [&device] { return getHardwareStatus(device); });
+}
+inline auto getSystemStatusAsync(USB::Device &device) {
+  return call(device, [&device] { return getSystemStatus(device); });
+}
+inline auto getMainStatusAsync(USB::Device &device) {
+  return call(device, [&device] { return getMainStatus(device); });
+}
+inline auto getStatusAsync(USB::Device &device, HardwareStatus &hardwareStatus,
+                           SystemStatus &systemStatus,
+                           MainStatus &mainStatus) {
+  return call(device, [&device, &hardwareStatus, &systemStatus, &mainStatus] {
+    return getStatus(device, hardwareStatus, systemStatus, mainStatus);
+  });
+}
+inline auto getVersionAsync(USB::Device &device) {
+  return call(device, [&device] { return getVersion(device); });
+}
+inline auto getFirmwareTagAsync(USB::Device &device) {
+  return call(device, [&device] { return getFirmwareTag(device); });
+}
+
+/// Chipset Control Commands
+inline auto softwareResetAsync(USB::Device &device) {
+  return call(device, [&device] { return softwareReset(device); });
+}
+
+inline auto getPowerModeAsync(USB::Device &device) {
+  return call(device, [&device] { return getPowerMode(device); });
+}
+inline auto setPowerModeAsync(USB::Device &device, PowerMode mode) {
+  return call(device, [&device, mode] { return setPowerMode(device, mode); });
+}
+
+inline auto getColorCurtainAsync(USB::Device &device) {
+  return call(device, [&device] { return getColorCurtain(device); });
+}
+inline auto setColorCurtainAsync(USB::Device &device, uint16_t red,
+                                 uint16_t green, uint16_t blue) {
+  return call(device, [&device, red, green, blue] {
+    return setColorCurtain(device, red, green, blue);
+  });
+}
+
+inline auto getInputSourceAsync(USB::Device &device) {
+  return call(device, [&device] { return getInputSource(device); });
+}
+inline auto
+setInputSourceAsync(USB::Device &device, InputType type,
+                    InputBitDepth bitDepth = InputBitDepth::INTERNAL) {
+  return call(device, [&device, type, bitDepth] {
+    return setInputSource(device, type, bitDepth);
+  });
+}
+
+inline auto getTestPatternAsync(USB::Device &device) {
+  return call(device, [&device] { return getTestPattern(device); });
+}
+inline auto setTestPatternAsync(USB::Device &device, TestPattern pattern) {
+  return call(device,
+              [&device, pattern] { return setTestPattern(device, pattern); });
+}
+
+inline auto getLEDEnableAsync(USB::Device &device) {
+  return call(device, [&device] { return getLEDEnable(device); });
+}
+inline auto setLEDEnableAsync(USB::Device &device, LEDEnableMode mode,
+                              bool redEnabled = true, bool greenEnabled = true,
+                              bool blueEnabled = true) {
+  return call(device, [&device, mode, redEnabled, greenEnabled, blueEnabled] {
+    return setLEDEnable(device, mode, redEnabled, greenEnabled, blueEnabled);
+  });
+}
+
+inline auto getLEDCurrentAsync(USB::Device &device) {
+  return call(device, [&device] { return getLEDCurrent(device); });
+}
+inline auto setLEDCurrentAsync(USB::Device &device, uint8_t red,
+                               uint8_t green, uint8_t blue) {
+  return call(device, [&device, red, green, blue] {
+    return setLEDCurrent(device, red, green, blue);
+  });
+}
+
+/// Display Sequences
+inline auto getDisplayModeAsync(USB::Device &device) {
+  return call(device, [&device] { return getDisplayMode(device); });
+}
+inline auto setDisplayModeAsync(USB::Device &device, DisplayMode mode) {
+  return call(device, [&device, mode] { return setDisplayMode(device, mode); });
+}
+
+inline auto getGammaCorrectionAsync(USB::Device &device) {
+  return call(device, [&device] { return getGammaCorrection(device); });
+}
+inline auto setGammaCorrectionAsync(USB::Device &device, bool enable,
+                                    bool degammaTable = false) {
+  return call(device, [&device, enable, degammaTable] {
+    return setGammaCorrection(device, enable, degammaTable);
+  });
+}
+
+inline auto startPatternValidationAsync(USB::Device &device) {
+  return call(device, [&device] { return startPatternValidation(device); });
+}
+inline auto checkPatternValidationAsync(USB::Device &device) {
+  return call(device, [&device] { return checkPatternValidation(device); });
+}
+
+inline auto getPatternTriggerModeAsync(USB::Device &device) {
+  return call(device, [&device] { return getPatternTriggerMode(device); });
+}
+inline auto setPatternTriggerModeAsync(USB::Device &device,
+                                       PatternTriggerMode mode) {
+  return call(device,
+              [&device, mode] { return setPatternTriggerMode(device, mode); });
+}
+
+inline auto getPatternDataSourceAsync(USB::Device &device) {
+  return call(device, [&device] { return getPatternDataSource(device); });
+}
+inline auto setPatternDataSourceAsync(USB::Device &device,
+                                      PatternDataSource input) {
+  return call(device,
+              [&device, input] { return setPatternDataSource(device, input); });
+}
+
+inline auto getPatternStatusAsync(USB::Device &device) {
+  return call(device, [&device] { return getPatternStatus(device); });
+}
+inline auto setPatternStatusAsync(USB::Device &device, PatternStatus mode) {
+  return call(device,
+              [&device, mode] { return setPatternStatus(device, mode); });
+}
+
+inline auto getPatternPeriodAsync(USB::Device &device) {
+  return call(device, [&device] { return getPatternPeriod(device); });
+}
+inline auto setPatternPeriodAsync(USB::Device &device, uint32_t exposure,
+                                  uint32_t frame) {
+  return call(device, [&device, exposure, frame] {
+    return setPatternPeriod(device, exposure, frame);
+  });
+}
+
+inline auto setMailboxModeAsync(USB::Device &device, MailboxMode mode) {
+  return call(device, [&device, mode] { return setMailboxMode(device, mode); });
+}
+
+inline auto setMailboxOffsetAsync(USB::Device &device, uint8_t offset) {
+  return call(device,
+              [&device, offset] { return setMailboxOffset(device, offset); });
+}
+inline auto setMailboxVarExpOffsetAsync(USB::Device &device, uint16_t offset) {
+  return call(device, [&device, offset] {
+    return setMailboxVarExpOffset(device, offset);
+  });
+}
+
+inline auto configurePatternSequenceAsync(USB::Device &device,
+                                          PatternSequence &patternSequence,
+                                          bool repeat = true,
+                                          uint8_t patternNumPerTrigOut2 = 1) {
+  return call(device, [&device, &patternSequence, repeat,
+                       patternNumPerTrigOut2] {
+    return configurePatternSequence(device, patternSequence, repeat,
+                                    patternNumPerTrigOut2);
+  });
+}
+inline auto
+configureVarExpPatSequenceAsync(USB::Device &device,
+                                VarExpPatSequence &varExpPatSequence,
+                                bool repeat = true,
+                                uint16_t varExpPatNumPerTrigOut2 = 1) {
+  return call(device, [&device, &varExpPatSequence, repeat,
+                       varExpPatNumPerTrigOut2] {
+    return configureVarExpPatSequence(device, varExpPatSequence, repeat,
+                                      varExpPatNumPerTrigOut2);
+  });
+}
+
+inline auto sendPatternDisplayLUTAsync(USB::Device &device,
+                                       PatternSequence &patternSequence) {
+  return call(device, [&device, &patternSequence] {
+    return sendPatternDisplayLUT(device, patternSequence);
+  });
+}
+inline auto sendVarExpPatDisplayLUTAsync(USB::Device &device,
+                                         VarExpPatSequence &varExpPatSequence) {
+  return call(device, [&device, &varExpPatSequence] {
+    return sendVarExpPatDisplayLUT(device, varExpPatSequence);
+  });
+}
+
+}; // namespace multi350
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef MULTI350_FAULT_HPP
+#define MULTI350_FAULT_HPP
+
+#include "transport.hpp"
+#include "usb.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <random>
+#include <string>
+
+namespace multi350 {
+namespace sim {
+
+/// @brief Misbehaviour injected by a FaultTransport. Rates are probabilities
+/// per reply (per report for disconnects), latencies are added on top of the
+/// latency of the wrapped transport.
+struct Faults {
+  /// @brief Latency added to every reply
+  std::chrono::microseconds latency{0};
+  /// @brief Upper bound of the uniformly distributed jitter added on top
+  std::chrono::microseconds jitter{0};
+  /// @brief Rate and duration of latency spikes, forming the tail
+  double spikeRate{0};
+  std::chrono::microseconds spike{0};
+  /// @brief Rate of replies that are never delivered
+  double dropRate{0};
+  /// @brief Rate of replies delivered with flags.error set
+  double errorRate{0};
+  /// @brief Rate of replies cut short within the packet
+  double shortReadRate{0};
+  /// @brief Rate of reports on which the transport fails for good
+  double disconnectRate{0};
+  /// @brief Seed of the fault generator, equal seeds give equal faults
+  uint32_t seed{0};
+};
+
+/// @brief Number of faults injected so far
+struct FaultStats {
+  uint64_t replies{0};
+  uint64_t spikes{0};
+  uint64_t dropped{0};
+  uint64_t errors{0};
+  uint64_t shortReads{0};
+  uint64_t disconnects{0};
+};
+
+/// @brief Transport decorator injecting latency, lost or damaged replies and
+/// disconnects into the reports of the wrapped transport. Replies keep their
+/// order, a delayed reply holds back the ones behind it like on the
+/// interrupt endpoint.
+class FaultTransport : public USB::Transport {
+public:
+  FaultTransport(std::unique_ptr<USB::Transport> _inner, Faults _faults);
+
+  bool isOpen() const override;
+  void close() override;
+  inline const std::string &getPath() const override {
+    return inner->getPath();
+  }
+  int32_t read(uint8_t *data, size_t size, int32_t timeout) override;
+  int32_t write(const uint8_t *data, size_t size) override;
+
+  /// @brief Faults injected so far. Only consistent while no transaction is
+  /// running on the transport.
+  inline const FaultStats &getStats() const { return stats; }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Pending {
+    USB::Report report;
+    int32_t size;
+    Clock::time_point readyAt;
+  };
+
+  /// @brief Draw whether a fault with the given rate happens
+  bool happens(double rate);
+
+  /// @brief Fail the transport if a disconnect is drawn
+  /// @return True if the transport failed
+  bool disconnect();
+
+  std::unique_ptr<USB::Transport> inner;
+  Faults faults;
+  FaultStats stats;
+  std::mt19937 generator;
+  std::deque<Pending> pending;
+  std::atomic<bool> failed; // read by isOpen on other threads
+};
+}; // namespace sim
+}; // namespace multi350
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef MULTI350_HIDRAW_HPP
+#define MULTI350_HIDRAW_HPP
+
+#ifdef __linux__
+
+#include "transport.hpp"
+#include "usb.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace multi350 {
+namespace USB {
+
+class HidrawTransport;
+
+/// @brief Single epoll event loop servicing every open hidraw node. Input
+/// reports are read as soon as they arrive and queued on their transport, so
+/// one thread covers any number of projectors without polling.
+class HidrawReactor {
+public:
+  /// @brief Reactor shared by all hidraw transports. Started on first use and
+  /// never destroyed, so transports closed during static destruction can
+  /// still unregister.
+  static HidrawReactor &instance();
+
+  HidrawReactor(const HidrawReactor &) = delete;
+  HidrawReactor &operator=(const HidrawReactor &) = delete;
+
+  /// @brief Start watching the node of a transport
+  /// @return True on success
+  bool add(HidrawTransport &transport);
+
+  /// @brief Stop watching the node of a transport. No callbacks for it are
+  /// running or will run once this returns.
+  void remove(HidrawTransport &transport);
+
+  /// @brief Watch the node of a transport for writability until the next
+  /// writable event
+  void waitWritable(HidrawTransport &transport);
+
+private:
+  HidrawReactor();
+  void run();
+
+  int epollFd;
+  uint64_t nextId;
+  std::unordered_map<uint64_t, HidrawTransport *> transports;
+  std::mutex mutex;
+  std::thread thread;
+};
+
+/// @brief Transport through a Linux hidraw node, serviced by HidrawReactor
+class HidrawTransport : public Transport {
+public:
+  HidrawTransport(int _fd, std::string _path);
+  ~HidrawTransport() override;
+
+  /// @brief Open a hidraw node
+  /// @param path Path of the node, e.g. /dev/hidraw0
+  /// @return Opened transport, nullptr on failure
+  static std::unique_ptr<HidrawTransport> open(const std::string &path);
+
+  inline bool isOpen() const override { return fd >= 0 && !failed; }
+  void close() override;
+  inline const std::string &getPath() const override { return path; }
+  int32_t read(uint8_t *data, size_t size, int32_t timeout) override;
+  int32_t write(const uint8_t *data, size_t size) override;
+
+private:
+  friend class HidrawReactor;
+
+  void onReadable();
+  void onWritable();
+  void onError();
+
+  std::atomic<int> fd;
+  uint64_t id;
+  std::string path;
+  std::atomic<bool> failed;
+  bool writable;
+  RingBuffer<Report, reportQueueSize> reports;
+  std::mutex mutex;
+  std::condition_variable condition;
+};
+
+/// @brief Find the hidraw nodes of all connected DLPC350s (interface 0)
+/// @return Paths of the nodes and serial numbers of the devices
+std::vector<DeviceInfo> enumerateHidraw();
+}; // namespace USB
+}; // namespace multi350
+
+#endif
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef MULTI350_IDENTITY_HPP
+#define MULTI350_IDENTITY_HPP
+
+#include <map>
+#include <optional>
+#include <string>
+
+namespace multi350 {
+
+/// @brief Persistent mapping of device identities (serial number, or USB path
+/// for devices without one) to logical projector indices. Stored as text, one
+/// "<index> <identity>" pair per line.
+class IdentityMap {
+public:
+  /// @brief Replace the mapping with the one stored in a file
+  /// @param file Path of the file
+  /// @return True on success, false if the file is missing or malformed
+  bool load(const std::string &file);
+
+  /// @brief Store the mapping in a file
+  /// @param file Path of the file
+  /// @return True on success
+  bool save(const std::string &file) const;
+
+  /// @brief Logical index of a device
+  /// @param identity Identity of the device
+  /// @return Index, empty if the device is unknown
+  std::optional<unsigned int> get(const std::string &identity) const;
+
+  /// @brief Assign a logical index to a device
+  /// @param identity Identity of the device
+  /// @param index Logical index
+  void set(const std::string &identity, unsigned int index);
+
+  /// @brief Number of known devices
+  inline size_t size() const { return indices.size(); }
+
+  inline void clear() { indices.clear(); }
+
+private:
+  std::map<std::string, unsigned int> indices;
+};
+}; // namespace multi350
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef MULTI350_LOG_HPP
+#define MULTI350_LOG_HPP
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <concepts>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+namespace multi350 {
+
+/// @brief Severity of a log line
+enum class Severity : uint8_t { DEBUG, INFO, WARNING, ERROR };
+
+/// @brief Maximum number of characters of a log line, longer lines are cut
+constexpr size_t logLineSize = 240;
+
+/// @brief Number of lines queued for the sink thread. Lines logged while the
+/// queue is full are dropped and counted instead of blocking the caller.
+constexpr size_t logQueueSize = 1024;
+
+/// @brief Writes the lines taken off the queue, called on the sink thread only
+using LogSink = std::function<void(Severity severity, std::string_view line)>;
+
+/// @brief Set the lowest severity that is logged. Lines below it are not
+/// even formatted. Defaults to INFO.
+/// @param severity Lowest logged severity
+extern void setLogLevel(Severity severity);
+
+/// @brief Lowest severity that is logged
+extern Severity getLogLevel();
+
+/// @brief Replace the sink of the log lines. The default sink writes INFO
+/// and DEBUG lines to std::cout and the others to std::cerr, flushing once
+/// the queue is empty.
+/// @param sink Sink to use, empty to restore the default
+extern void setLogSink(LogSink sink);
+
+/// @brief Wait until all lines logged so far went through the sink
+extern void flushLog();
+
+/// @brief Number of lines dropped because the queue was full
+extern uint64_t getDroppedLogLines();
+
+/// @brief Single log line, formatted on the stack of the caller and queued
+/// for the sink thread when it goes out of scope. Logging never waits on the
+/// terminal or a file.
+class LogLine {
+public:
+  explicit LogLine(Severity _severity);
+  ~LogLine();
+
+  LogLine(const LogLine &) = delete;
+  LogLine &operator=(const LogLine &) = delete;
+
+  inline LogLine &operator<<(std::string_view text) {
+    if (enabled) {
+      size_t size = std::min(text.size(), logLineSize - length);
+      text.copy(line.data() + length, size);
+      length += size;
+    }
+    return *this;
+  }
+
+  inline LogLine &operator<<(const char *text) {
+    return *this << std::string_view(text);
+  }
+
+  inline LogLine &operator<<(const std::string &text) {
+    return *this << std::string_view(text);
+  }
+
+  inline LogLine &operator<<(char character) {
+    return *this << std::string_view(&character, 1);
+  }
+
+  inline LogLine &operator<<(bool value) { return *this << (value ? 1 : 0); }
+
+  /// @brief Integers are printed as numbers, uint8_t included
+  template <std::integral T> inline LogLine &operator<<(T value) {
+    if (enabled) {
+      auto result = std::to_chars(line.data() + length,
+                                  line.data() + logLineSize, value);
+      length = result.ptr - line.data();
+    }
+    return *this;
+  }
+
+  inline LogLine &operator<<(double value) {
+    if (enabled) {
+      auto result = std::to_chars(line.data() + length,
+                                  line.data() + logLineSize, value);
+      length = result.ptr - line.data();
+    }
+    return *this;
+  }
+
+private:
+  Severity severity;
+  bool enabled;
+  size_t length;
+  std::array<char, logLineSize> line;
+};
+
+inline LogLine logDebug() { return LogLine(Severity::DEBUG); }
+inline LogLine logInfo() { return LogLine(Severity::INFO); }
+inline LogLine logWarning() { return LogLine(Severity::WARNING); }
+inline LogLine logError() { return LogLine(Severity::ERROR); }
+}; // namespace multi350
+
+#endif
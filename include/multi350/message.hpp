@@ -1,17 +1,22 @@
 #ifndef MULTI350_MESSAGE_HPP
 #define MULTI350_MESSAGE_HPP
 
+#include "log.hpp"
+#include "trace.hpp"
 #include "usb.hpp"
 #include <algorithm>
-#include <iomanip>
-#include <iostream>
+#include <array>
+#include <cassert>
+#include <cstring>
+#include <span>
+#include <type_traits>
 #include <utility>
 
 namespace multi350 {
 
 namespace internal {
 constexpr size_t maxMessageDataSize = 512;
-constexpr bool verbose = false;
+constexpr size_t headerSize = 4;
 }; // namespace internal
 
 struct Message {
@@ -43,7 +48,7 @@ struct Message {
     }
   }
 
-  struct {
+  struct Flags {
     uint8_t destination : 3;
     uint8_t reserved : 2;
     bool error : 1;
@@ -60,130 +65,683 @@ struct Message {
   };
 };
 
-extern inline std::unique_ptr<Message> read() {
-  auto received = USB::read();
+/// @brief Deadline class of a command. Reads are answered from registers,
+/// while validation and mode transitions are acknowledged once done.
+/// @param command Command code
+/// @param type Read or write
+/// @return Deadline class of the reply
+constexpr USB::Deadline getDeadline(uint16_t command, Message::Type type) {
+  if (type == Message::Type::READ)
+    return USB::Deadline::SHORT;
+
+  switch (command) {
+  case 0x0200: // power mode
+  case 0x1A1A: // pattern validation
+  case 0x1A1B: // display mode
+  case 0x1A24: // pattern status
+    return USB::Deadline::LONG;
+  default:
+    return USB::Deadline::NORMAL;
+  }
+}
+
+/// @brief Non-owning view of a reply packet held in the in buffer of a
+/// device. Only valid until the next read on the device.
+///
+/// Replies longer than a packet continue in reports of USB::packetSize bytes
+/// without header. A view of the in buffer only holds the first packet, the
+/// rest is read with a Decoder. Views of reassembled replies hold all of it.
+class ReplyView {
+public:
+  ReplyView() : packet{nullptr}, capacity{0} {}
+
+  /// @param _packet Packet starting with the header
+  /// @param _capacity Number of payload bytes held behind the header
+  explicit ReplyView(const uint8_t *_packet,
+                     size_t _capacity = USB::packetSize - internal::headerSize)
+      : packet{_packet}, capacity{_capacity} {}
+
+  explicit operator bool() const { return packet != nullptr; }
+
+  inline Message::Flags getFlags() const {
+    Message::Flags flags;
+    memcpy(&flags, packet, sizeof(flags));
+    return flags;
+  }
 
-  if (received == nullptr) {
-    std::cerr << "Message Read failed" << std::endl;
-    return nullptr;
+  inline uint8_t getSequence() const { return packet[1]; }
+
+  /// @brief Check if this is the reply to a message. Replies do not echo the
+  /// command, so the sequence number and the read/write type are compared.
+  inline bool answers(uint8_t sequence, Message::Type type) const {
+    return getSequence() == sequence && getFlags().rw == type;
+  }
+
+  inline bool answers(const Message &msg) const {
+    return answers(msg.sequence, msg.flags.rw);
   }
 
-  auto ret =
-      std::unique_ptr<Message>(new Message(), std::default_delete<Message>());
-  memcpy(ret.get(), received.get(), USB::bufferSize);
+  /// @brief Raw packet starting with the header
+  inline const uint8_t *getPacket() const { return packet; }
+
+  inline uint16_t getLength() const { return packet[2] | (packet[3] << 8); }
 
-  return ret;
+  /// @brief Payload held by the view
+  inline std::span<const uint8_t> getData() const {
+    return {packet + internal::headerSize,
+            std::min<size_t>(getLength(), capacity)};
+  }
+
+  /// @brief Number of payload bytes held behind the header
+  inline size_t getCapacity() const { return capacity; }
+
+  /// @brief Check if the whole payload is held, otherwise it continues in
+  /// the next reports
+  inline bool isComplete() const { return getLength() <= capacity; }
+
+  /// @brief Copy the payload into a value
+  /// @param value Value to fill, at most the held payload is copied
+  template <typename T> inline void copyTo(T &value) const {
+    memcpy(&value, packet + internal::headerSize,
+           std::min(sizeof(T), capacity));
+  }
+
+private:
+  const uint8_t *packet;
+  size_t capacity;
+};
+
+/// @brief Read a single reply packet into the in buffer of the device
+/// @param device Device to read from
+/// @param deadline Deadline class of the awaited reply
+/// @return View of the packet, empty on failure or timeout
+extern inline ReplyView read(USB::Device &device,
+                             USB::Deadline deadline = USB::Deadline::LONG) {
+  int32_t readBytes = device.read(deadline);
+  if (readBytes <= 0) {
+    trace(device.getTraceId(),
+          readBytes == 0 ? TraceEvent::Type::TIMEOUT
+                         : TraceEvent::Type::FAILURE,
+          0, 0, 0, 0);
+    logError() << "Message Read failed";
+    return ReplyView();
+  }
+
+  // the rest of the in buffer still holds the previous reply
+  ReplyView received(device.getInBuffer());
+  if (readBytes < static_cast<int32_t>(internal::headerSize) ||
+      readBytes < static_cast<int32_t>(internal::headerSize +
+                                       received.getData().size())) {
+    logError() << "Message Read too short: " << readBytes << " bytes";
+    return ReplyView();
+  }
+  trace(device.getTraceId(), TraceEvent::Type::READ, received.getSequence(),
+        received.getPacket()[0], 0, received.getLength());
+  if (received.getLength() > internal::maxMessageDataSize) {
+    logError() << "Message Read too long: " << received.getLength() << " bytes";
+    return ReplyView();
+  }
+
+  return received;
 }
 
-extern inline int32_t write(Message &msg) {
-  uint16_t headerBytes =
-      sizeof(msg.flags) + sizeof(msg.sequence) + sizeof(msg.length);
-  uint16_t maxDataSize = USB::packetSize - headerBytes;
-  uint16_t totalWrittenBytes = 0;
-  uint16_t writtenBytes = std::min(msg.length, maxDataSize);
-
-  USB::Buffer buffer(new uint8_t[USB::bufferSize]);
-  memset(buffer.get(), 0, sizeof(uint8_t) * USB::bufferSize);
-  memcpy(buffer.get() + 1, &msg,
-         sizeof(uint8_t) * (headerBytes + writtenBytes));
-  if (USB::write(buffer) == -1) {
-    std::cerr << "Message write failed" << std::endl;
-    return -1;
+/// @brief Reassembles a reply that continues beyond its first packet. The
+/// continuation reports are read from the device as the payload is taken,
+/// straight out of the in buffer. The caller must hold the device lock.
+class Decoder {
+public:
+  /// @brief Start with the first packet of a reply
+  /// @param _device Device the reply is read from
+  /// @param first First packet of the reply, in the in buffer of the device
+  Decoder(USB::Device &_device, ReplyView first)
+      : device{_device}, data{first.getData().data()},
+        available{first.getData().size()}, position{0},
+        left{first.getLength() - first.getData().size()}, failed{false} {}
+
+  Decoder(const Decoder &) = delete;
+  Decoder &operator=(const Decoder &) = delete;
+
+  /// @brief Take the next bytes of the payload
+  /// @param target Buffer to fill
+  /// @param size Number of bytes to take
+  /// @return False if the reply is shorter or a report could not be read
+  inline bool get(void *target, size_t size) {
+    auto *bytes = static_cast<uint8_t *>(target);
+    while (size > 0) {
+      if (position == available && !next())
+        return false;
+
+      size_t chunk = std::min(size, available - position);
+      memcpy(bytes, data + position, chunk);
+      position += chunk;
+      bytes += chunk;
+      size -= chunk;
+    }
+    return true;
   }
 
-  totalWrittenBytes += writtenBytes;
+  /// @brief Read the reports of the reply that were not taken, so the next
+  /// reply starts with a header
+  /// @return True if the whole reply was read
+  inline bool finish() {
+    while (left > 0 && next()) {
+    }
+    return !failed;
+  }
 
-  while (totalWrittenBytes < msg.length) {
-    writtenBytes =
-        std::min(static_cast<uint16_t>(USB::packetSize),
-                 static_cast<uint16_t>(msg.length - totalWrittenBytes));
-    memcpy(buffer.get() + 1, &msg.data[totalWrittenBytes],
-           sizeof(uint8_t) * writtenBytes);
-    if (USB::write(buffer) == -1) {
-      std::cerr << "Message write failed" << std::endl;
-      return -1;
+private:
+  inline bool next() {
+    if (failed || left == 0)
+      return false;
+
+    // continuations follow right behind the first packet
+    int32_t readBytes = device.read(USB::Deadline::SHORT);
+    size_t expected = std::min(left, USB::packetSize);
+    if (readBytes < static_cast<int32_t>(expected)) {
+      logError() << "Message continuation read failed";
+      failed = true;
+      return false;
     }
-    totalWrittenBytes += writtenBytes;
+
+    data = device.getInBuffer();
+    available = expected;
+    position = 0;
+    left -= expected;
+    return true;
   }
 
-  return totalWrittenBytes + headerBytes;
-}
+  USB::Device &device;
+  const uint8_t *data;
+  size_t available;
+  size_t position;
+  size_t left;
+  bool failed;
+};
 
+/// @brief Copy the payload of a reply into a value, reading the rest of the
+/// reply if it continues beyond the first packet
+/// @param device Device the reply is read from
+/// @param received First packet of the reply
+/// @param value Value to fill, at most the payload is copied
+/// @return True if the whole reply was read
 template <typename T>
-using MessageData = std::unique_ptr<T, std::default_delete<T[]>>;
+inline bool copyReply(USB::Device &device, ReplyView received, T &value) {
+  if (received.isComplete()) {
+    received.copyTo(value);
+    return true;
+  }
 
-template <typename T = uint8_t> extern MessageData<T> transact(Message &msg) {
-  int32_t result = write(msg);
+  Decoder decoder(device, received);
+  decoder.get(&value, std::min<size_t>(sizeof(T), received.getLength()));
+  return decoder.finish();
+}
 
-  if (internal::verbose) {
-    std::cout << "W(" << msg.length << "): ";
-    for (int i = 0; i < msg.length; ++i) {
-      std::cout << std::hex << std::setw(4)
-                << static_cast<unsigned int>(msg.data[i]) << " ";
-    }
-    std::cout << std::endl;
+/// @brief Encodes a message straight into the out buffer of a device. The
+/// header is placed in the first report and data is appended behind it, every
+/// report is written as soon as it is full, so long messages like LUTs are
+/// never staged. The caller must hold the device lock.
+class Encoder {
+public:
+  /// @brief Start a message
+  /// @param _device Device to write to
+  /// @param flags Flags of the header
+  /// @param sequence Sequence number of the header
+  /// @param _length Number of data bytes that will be put, command included
+  Encoder(USB::Device &_device, Message::Flags flags, uint8_t sequence,
+          uint16_t _length)
+      : device{_device}, report{_device.getOutBuffer()}, length{_length},
+        position{1 + internal::headerSize}, written{0}, headerFlags{0},
+        headerSequence{0}, command{0}, failed{false} {
+    report[0] = 0; // report ID
+    memcpy(&report[1], &flags, sizeof(flags));
+    report[2] = sequence;
+    report[3] = static_cast<uint8_t>(length & 0xFF);
+    report[4] = static_cast<uint8_t>(length >> 8);
   }
 
-  if (msg.flags.reply) {
-    if (result <= 0) {
-      std::cerr << "Failed to send message" << std::endl;
-      return nullptr;
-    }
+  Encoder(const Encoder &) = delete;
+  Encoder &operator=(const Encoder &) = delete;
 
-    auto received = read();
+  /// @brief Append a value as it is stored
+  template <typename T> inline void put(const T &value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    put(&value, sizeof(T));
+  }
 
-    if (received == nullptr) {
-      std::cerr << "Failed to receive proper reply" << std::endl;
-      return nullptr;
+  /// @brief Append bytes, writing every report that fills up
+  inline void put(const void *data, size_t size) {
+    auto *bytes = static_cast<const uint8_t *>(data);
+    while (size > 0) {
+      size_t chunk = std::min(size, USB::bufferSize - position);
+      memcpy(&report[position], bytes, chunk);
+      position += chunk;
+      bytes += chunk;
+      size -= chunk;
+      if (position == USB::bufferSize)
+        flush();
     }
-    if (received->flags.error ||
-        (received->flags.rw == Message::Type::READ && received->length == 0)) {
-      std::cerr << "Reply is empty/erroneous" << std::endl;
-      return nullptr;
+  }
+
+  /// @brief Write the last report, padded with zeros
+  /// @return Number of bytes written including the header, -1 on failure
+  inline int32_t finish() {
+    if (position > 1) {
+      memset(&report[position], 0, USB::bufferSize - position);
+      flush();
     }
+    assert(failed || written == internal::headerSize + length);
 
-    MessageData<T> ret(new T[USB::packetSize]);
-    memcpy(ret.get(), received->data, USB::packetSize);
+    trace(device.getTraceId(),
+          failed ? TraceEvent::Type::FAILURE : TraceEvent::Type::WRITE,
+          headerSequence, headerFlags, command, length);
+    if (failed) {
+      logError() << "Message write failed";
+      return -1;
+    }
+    return static_cast<int32_t>(written);
+  }
 
-    if (internal::verbose) {
-      std::cout << "R(" << received->length << "): ";
-      for (int i = 0; i < received->length; ++i) {
-        std::cout << std::hex << std::setw(4)
-                  << static_cast<unsigned int>(received->data[i]) << " ";
-      }
-      std::cout << std::endl;
+private:
+  inline void flush() {
+    // the header is gone from the out buffer once the first report is written
+    if (written == 0) {
+      headerFlags = report[1];
+      headerSequence = report[2];
+      command = report[5] | (report[6] << 8);
     }
+    // the rest of a failed message is dropped
+    if (!failed && device.write() == -1)
+      failed = true;
+    written += position - 1;
+    position = 1;
+  }
+
+  USB::Device &device;
+  uint8_t *report;
+  uint16_t length;
+  size_t position;
+  size_t written;
+  uint8_t headerFlags;
+  uint8_t headerSequence;
+  uint16_t command;
+  bool failed;
+};
+
+extern inline int32_t write(USB::Device &device, Message &msg) {
+  Encoder encoder(device, msg.flags, msg.sequence, msg.length);
+  encoder.put(msg.data, msg.length);
+  return encoder.finish();
+}
+
+/// @brief Read the reply to a message written with a sequence number. Late
+/// replies to requests that timed out before are skipped.
+/// @param device Device to read from
+/// @param sequence Sequence number of the message
+/// @param type Read or write, replies echo it
+/// @param deadline Deadline class of the reply
+/// @return View of the reply, empty on failure or if not acknowledged
+extern inline ReplyView receiveReply(USB::Device &device, uint8_t sequence,
+                                     Message::Type type,
+                                     USB::Deadline deadline) {
+  auto received = read(device, deadline);
+  for (size_t skipped = 0; received && !received.answers(sequence, type);
+       ++skipped) {
+    logWarning() << "Discarding stale reply with sequence "
+                 << static_cast<unsigned int>(received.getSequence());
+    if (!received.isComplete())
+      Decoder(device, received).finish();
+    received = (skipped < USB::reportQueueSize) ? read(device, deadline)
+                                                : ReplyView();
+  }
+
+  if (!received) {
+    logError() << "Failed to receive proper reply";
+    return ReplyView();
+  }
+  auto flags = received.getFlags();
+  if (flags.error ||
+      (flags.rw == Message::Type::READ && received.getLength() == 0)) {
+    logError() << "Reply is empty/erroneous";
+    return ReplyView();
+  }
+
+  return received;
+}
+
+/// @brief Send a message and read its reply without allocating. The caller
+/// must hold the device lock for as long as the returned view is used.
+/// @param device Device to transact with
+/// @param msg Message expecting a reply
+/// @return View of the reply, empty on failure
+extern inline ReplyView transactView(USB::Device &device, Message &msg) {
+  device.drain();
+  msg.sequence = device.nextSequence();
+  int32_t result = write(device, msg);
+
+  if (!msg.flags.reply) {
+    logError() << "Message set to no ack. Use sendNoAckMessage.";
+    return ReplyView();
+  }
+
+  if (result <= 0) {
+    logError() << "Failed to send message";
+    return ReplyView();
+  }
+
+  return receiveReply(device, msg.sequence, msg.flags.rw,
+                      getDeadline(msg.command, msg.flags.rw));
+}
 
-    return ret;
+/// @brief Encode a message straight into the out buffer of the device and
+/// read its reply. The caller must hold the device lock for as long as the
+/// returned view is used.
+/// @param device Device to transact with
+/// @param type Read or write
+/// @param command Command code
+/// @param length Number of data bytes, command included
+/// @param encode Called with the Encoder to put the data after the command
+/// @return View of the reply, empty on failure
+template <typename Encode>
+inline ReplyView transactEncoded(USB::Device &device, Message::Type type,
+                                 uint16_t command, uint16_t length,
+                                 Encode &&encode) {
+  device.drain();
+  uint8_t sequence = device.nextSequence();
+
+  Encoder encoder(device, Message::Flags{0, 0, 0, 1, type}, sequence, length);
+  encoder.put(command);
+  encode(encoder);
+  if (encoder.finish() <= 0) {
+    logError() << "Failed to send message";
+    return ReplyView();
   }
 
-  std::cerr << "Message set to no ack. Use transactNoAck(Msg)." << std::endl;
+  return receiveReply(device, sequence, type, getDeadline(command, type));
+}
+
+/// @brief Send a message and check that it was acknowledged
+/// @return True on success
+extern inline bool transact(USB::Device &device, Message &msg) {
+  std::lock_guard<std::mutex> lock(device.getMutex());
+  auto received = transactView(device, msg);
+  if (!received)
+    return false;
+
+  // the payload is not needed, but has to be read off the device
+  if (!received.isComplete())
+    return Decoder(device, received).finish();
+  return true;
+}
+
+/// @brief Send a message and copy the reply payload into a value
+/// @return True on success
+template <typename T>
+extern inline bool transact(USB::Device &device, Message &msg, T &value) {
+  std::lock_guard<std::mutex> lock(device.getMutex());
+  auto received = transactView(device, msg);
+  if (!received)
+    return false;
 
-  return nullptr;
+  return copyReply(device, received, value);
 }
 
-template <typename T = uint8_t>
-extern inline MessageData<T> sendGetMessage(uint16_t cmd) {
-  auto send = Message(Message::Type::READ, cmd);
-  return transact<T>(send);
+template <typename T>
+extern inline bool sendGetMessage(USB::Device &device, uint16_t cmd,
+                                  T &value) {
+  std::lock_guard<std::mutex> lock(device.getMutex());
+  auto received = transactEncoded(device, Message::Type::READ, cmd,
+                                  sizeof(cmd), [](Encoder &) {});
+  if (!received)
+    return false;
+
+  return copyReply(device, received, value);
 }
 
 template <typename... ParamList>
-extern inline MessageData<uint8_t> sendSetMessage(uint16_t cmd,
-                                                  ParamList &&...params) {
+extern inline bool sendSetMessage(USB::Device &device, uint16_t cmd,
+                                  ParamList &&...params) {
   auto send =
       Message(Message::Type::WRITE, cmd, std::forward<ParamList>(params)...);
-  return transact<uint8_t>(send);
+  return transact(device, send);
 }
 
 template <typename... ParamList>
-extern inline int32_t sendNoAckMessage(uint16_t cmd, ParamList &&...params) {
+extern inline int32_t sendNoAckMessage(USB::Device &device, uint16_t cmd,
+                                       ParamList &&...params) {
   auto send =
       Message(Message::Type::WRITE, cmd, std::forward<ParamList>(params)...);
   send.flags.reply = false;
 
-  return write(send);
+  std::lock_guard<std::mutex> lock(device.getMutex());
+  send.sequence = device.nextSequence();
+  return write(device, send);
 }
+
+/// @brief Keeps several requests in flight on a single device. Every request
+/// is tagged with its own sequence number and replies are matched back to
+/// their request as they arrive, so a chain of commands costs about one round
+/// trip instead of one per command. Holds the device lock while alive.
+class Pipeline {
+public:
+  /// @brief Handle of a posted request, negative if posting failed
+  using Ticket = int;
+
+  /// @brief Maximum number of requests in flight
+  static constexpr size_t window = 8;
+
+  explicit Pipeline(USB::Device &_device)
+      : device{_device}, lock{_device.getMutex()} {}
+
+  Pipeline(const Pipeline &) = delete;
+  Pipeline &operator=(const Pipeline &) = delete;
+
+  /// @brief Device the requests are written to, locked by the pipeline
+  inline USB::Device &getDevice() { return device; }
+
+  /// @brief Write a message without waiting for its reply. Blocks for
+  /// replies while the window is full.
+  /// @param msg Message expecting a reply
+  /// @return Ticket to wait on, negative on failure
+  inline Ticket post(Message &msg) {
+    if (!msg.flags.reply) {
+      logError() << "Message set to no ack. Use sendNoAckMessage.";
+      return -1;
+    }
+
+    return postEncoded(msg.flags.rw, msg.command, msg.length,
+                       [&msg](Encoder &encoder) {
+                         encoder.put(&msg.data[sizeof(msg.command)],
+                                     msg.length - sizeof(msg.command));
+                       });
+  }
+
+  /// @brief Encode a message straight into the out buffer of the device
+  /// without waiting for its reply. Blocks for replies while the window is
+  /// full.
+  /// @param type Read or write
+  /// @param command Command code
+  /// @param length Number of data bytes, command included
+  /// @param encode Called with the Encoder to put the data after the command
+  /// @return Ticket to wait on, negative on failure
+  template <typename Encode>
+  inline Ticket postEncoded(Message::Type type, uint16_t command,
+                            uint16_t length, Encode &&encode) {
+    Ticket ticket = freeSlot();
+    while (ticket < 0 && inFlight > 0) {
+      receive();
+      ticket = freeSlot();
+    }
+    if (ticket < 0) {
+      logWarning() << "[Pipeline] Window full of uncollected replies";
+      return -1;
+    }
+
+    if (inFlight == 0)
+      device.drain();
+
+    uint8_t sequence = device.nextSequence();
+    Encoder encoder(device, Message::Flags{0, 0, 0, 1, type}, sequence,
+                    length);
+    encoder.put(command);
+    encode(encoder);
+    if (encoder.finish() <= 0) {
+      logError() << "Failed to send message";
+      return -1;
+    }
+
+    slots[ticket].state = Slot::State::IN_FLIGHT;
+    slots[ticket].sequence = sequence;
+    slots[ticket].type = type;
+    slots[ticket].deadline = getDeadline(command, type);
+    ++inFlight;
+    return ticket;
+  }
+
+  /// @brief Post a get command
+  inline Ticket postGet(uint16_t cmd) {
+    return postEncoded(Message::Type::READ, cmd, sizeof(cmd),
+                       [](Encoder &) {});
+  }
+
+  /// @brief Post a set command
+  template <typename... ParamList>
+  inline Ticket postSet(uint16_t cmd, ParamList &&...params) {
+    auto send =
+        Message(Message::Type::WRITE, cmd, std::forward<ParamList>(params)...);
+    return post(send);
+  }
+
+  /// @brief Wait for the reply of a request and check that it was
+  /// acknowledged. Releases the ticket.
+  /// @return True on success
+  inline bool wait(Ticket ticket) { return static_cast<bool>(collect(ticket)); }
+
+  /// @brief Wait for the reply of a request and copy its payload into a
+  /// value. Releases the ticket.
+  /// @return True on success
+  template <typename T> inline bool wait(Ticket ticket, T &value) {
+    auto received = collect(ticket);
+    if (!received)
+      return false;
+
+    received.copyTo(value);
+    return true;
+  }
+
+  /// @brief Wait for the reply of a request and release the ticket
+  /// @return View of the reply, only valid until the next post. Empty on
+  /// failure.
+  inline ReplyView collect(Ticket ticket) {
+    if (ticket < 0 || ticket >= static_cast<Ticket>(window) ||
+        slots[ticket].state == Slot::State::FREE)
+      return ReplyView();
+
+    while (slots[ticket].state == Slot::State::IN_FLIGHT) {
+      receive();
+    }
+
+    auto &slot = slots[ticket];
+    bool done = slot.state == Slot::State::DONE;
+    slot.state = Slot::State::FREE;
+
+    if (!done) {
+      logError() << "Reply is empty/erroneous";
+      return ReplyView();
+    }
+    return ReplyView(slot.packet.data(), slot.capacity);
+  }
+
+private:
+  struct Slot {
+    enum class State : uint8_t { FREE, IN_FLIGHT, DONE, FAILED };
+    State state{State::FREE};
+    uint8_t sequence{0};
+    Message::Type type{Message::Type::WRITE};
+    USB::Deadline deadline{USB::Deadline::SHORT};
+    // reassembled reply
+    std::array<uint8_t, internal::headerSize + internal::maxMessageDataSize>
+        packet{};
+    size_t capacity{0};
+  };
+
+  inline Ticket freeSlot() const {
+    for (size_t i = 0; i < window; ++i) {
+      if (slots[i].state == Slot::State::FREE)
+        return static_cast<Ticket>(i);
+    }
+    return -1;
+  }
+
+  inline void failInFlight() {
+    for (auto &slot : slots) {
+      if (slot.state == Slot::State::IN_FLIGHT)
+        slot.state = Slot::State::FAILED;
+    }
+    inFlight = 0;
+  }
+
+  /// @brief Read a single reply and hand it to its request
+  /// @return False if reading failed, which fails every request in flight.
+  /// So does a run of replies matching none of them longer than the report
+  /// queue, as receiveReply gives up after as well.
+  inline bool receive() {
+    // the next reply may belong to any request in flight
+    auto deadline = USB::Deadline::SHORT;
+    for (auto &slot : slots) {
+      if (slot.state == Slot::State::IN_FLIGHT)
+        deadline = std::max(deadline, slot.deadline);
+    }
+
+    auto received = read(device, deadline);
+
+    if (!received) {
+      failInFlight();
+      return false;
+    }
+
+    for (auto &slot : slots) {
+      auto flags = received.getFlags();
+      if (slot.state == Slot::State::IN_FLIGHT &&
+          slot.sequence == received.getSequence() && slot.type == flags.rw) {
+        bool failed = flags.error || (flags.rw == Message::Type::READ &&
+                                      received.getLength() == 0);
+        memcpy(slot.packet.data(), device.getInBuffer(), USB::packetSize);
+        slot.capacity = USB::packetSize - internal::headerSize;
+        if (!received.isComplete()) {
+          // continuations follow before the next reply
+          Decoder decoder(device, received);
+          failed = !decoder.get(&slot.packet[internal::headerSize],
+                                received.getLength()) ||
+                   failed;
+          slot.capacity = received.getLength();
+        }
+        slot.state = failed ? Slot::State::FAILED : Slot::State::DONE;
+        --inFlight;
+        unmatched = 0;
+        return true;
+      }
+    }
+
+    // late reply to a request that already failed
+    logWarning() << "[Pipeline] Discarding reply with unknown sequence "
+                 << static_cast<unsigned int>(received.getSequence());
+    if (!received.isComplete())
+      Decoder(device, received).finish();
+    if (++unmatched > USB::reportQueueSize) {
+      logError() << "[Pipeline] No reply among " << unmatched << " reports";
+      failInFlight();
+      unmatched = 0;
+      return false;
+    }
+    return true;
+  }
+
+  USB::Device &device;
+  std::lock_guard<std::mutex> lock;
+  std::array<Slot, window> slots;
+  size_t inFlight{0};
+  size_t unmatched{0}; // replies in a row that matched no request
+};
 }; // namespace multi350
 
 #endif
\ No newline at end of file
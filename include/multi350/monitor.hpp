@@ -0,0 +1,88 @@
+#ifndef MULTI350_MONITOR_HPP
+#define MULTI350_MONITOR_HPP
+
+#include "transport.hpp"
+#include "usb.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace multi350 {
+namespace USB {
+
+/// @brief Change of a device slot reported by the hot-plug monitor
+enum class DeviceEvent {
+  ADDED,      // new device attached to a new slot
+  REMOVED,    // device went away, its slot is kept and closed
+  RECONNECTED // device came back and was reopened in its previous slot
+};
+
+/// @brief Background hot-plug monitor. Enumerates the bus periodically and
+/// only opens or closes the devices that appeared or went away, others are
+/// left untouched. A device that comes back, or whose transport failed while
+/// still plugged in, is reopened in its previous slot so indices referring to
+/// it stay valid. Failed devices wake the monitor right away.
+class Monitor {
+public:
+  /// @brief Lists the connected devices
+  using Enumerator = std::function<std::vector<DeviceInfo>()>;
+
+  /// @brief Opens the transport to a device, nullptr on failure
+  using Opener =
+      std::function<std::unique_ptr<Transport>(const std::string &path)>;
+
+  /// @brief Called from the monitor thread for every slot that changed
+  using Listener = std::function<void(DeviceEvent event, unsigned int index)>;
+
+  /// @brief Start monitoring
+  /// @param _enumerator Lists the connected devices
+  /// @param _opener Opens a device that appeared
+  /// @param _listener Notified of the changes, may be empty
+  /// @param _interval Time between two enumerations
+  Monitor(Enumerator _enumerator, Opener _opener, Listener _listener,
+          std::chrono::milliseconds _interval = std::chrono::milliseconds(250));
+
+  /// @brief Start monitoring the devices of a backend
+  Monitor(Backend backend, Listener _listener,
+          std::chrono::milliseconds _interval = std::chrono::milliseconds(250));
+
+  ~Monitor();
+
+  Monitor(const Monitor &) = delete;
+  Monitor &operator=(const Monitor &) = delete;
+
+  /// @brief Enumerate once and apply the changes. Called periodically from
+  /// the monitor thread, may also be called to react immediately.
+  void poll();
+
+  /// @brief Poll as soon as possible instead of waiting for the interval
+  void wake();
+
+private:
+  void run();
+
+  Enumerator enumerator;
+  Opener opener;
+  Listener listener;
+  std::chrono::milliseconds interval;
+  unsigned int failureHandler;
+
+  std::set<std::string> present;
+  std::mutex pollMutex;
+
+  bool stopping;
+  bool woken;
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::thread thread;
+};
+}; // namespace USB
+}; // namespace multi350
+
+#endif
@@ -0,0 +1,235 @@
+#ifndef MULTI350_SIM_HPP
+#define MULTI350_SIM_HPP
+
+#include "monitor.hpp"
+#include "pattern.hpp"
+#include "transport.hpp"
+#include "usb.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace multi350 {
+namespace sim {
+
+using Clock = std::chrono::steady_clock;
+
+/// @brief Response timing of a simulated DLPC350. Durations may be set to zero
+/// to measure the protocol overhead alone, except validation which has to
+/// outlast one round trip for the busy bit to be observed.
+struct Timing {
+  /// @brief Interval between two reports on the interrupt endpoints
+  std::chrono::microseconds packetInterval{1000};
+  /// @brief Time to process a complete message before replying
+  std::chrono::microseconds processing{500};
+  /// @brief Time the validation busy bit stays set
+  std::chrono::microseconds validation{20000};
+  /// @brief Time until a new display mode is reported
+  std::chrono::microseconds displayModeSwitch{50000};
+  /// @brief Time until a new pattern status is reported
+  std::chrono::microseconds patternStatusSwitch{10000};
+  /// @brief Time until a new power mode is reported
+  std::chrono::microseconds powerModeSwitch{500000};
+};
+
+/// @brief Register file behind the DLPC350 commands. Values are stored as
+/// they appear on the wire.
+struct Registers {
+  uint8_t powerMode{0};
+  std::array<uint8_t, 6> colorCurtain{};
+  uint8_t inputSource{0};
+  uint8_t testPattern{0};
+  uint8_t ledEnable{0};
+  std::array<uint8_t, 3> ledCurrent{0x68, 0x87, 0x82}; // 255 - current
+  uint8_t displayMode{0};
+  uint8_t gammaCorrection{0};
+  uint8_t patternTriggerMode{0};
+  uint8_t patternDataSource{0};
+  uint8_t patternStatus{0};
+  uint32_t exposure{0x4010};
+  uint32_t period{0x411A};
+  uint8_t mailboxMode{0};
+  uint8_t mailboxOffset{0};
+  uint16_t mailboxVarExpOffset{0};
+  std::array<uint8_t, 4> patternConfig{};
+  std::array<uint8_t, 6> varExpPatConfig{};
+  uint8_t validation{0};
+  std::array<uint8_t, maxPatterns * 3> patternLUT{};
+  std::array<uint8_t, maxVarExpPats * 12> varExpPatLUT{};
+};
+
+/// @brief Software model of a single DLPC350 at the HID report level
+class Simulator {
+public:
+  /// @brief Largest message or reply payload, command included
+  static constexpr size_t maxMessageSize = 512;
+
+  /// @brief Reply payloads beyond the first report continue in reports
+  /// without header
+  static constexpr size_t maxReplyReports =
+      1 + (maxMessageSize - (USB::packetSize - 4) + USB::packetSize - 1) /
+              USB::packetSize;
+
+  /// @brief Single report of a reply
+  struct Reply {
+    USB::Report report;
+    /// @brief Time at which the report can be read
+    Clock::time_point readyAt;
+  };
+
+  explicit Simulator(std::string _serial, Timing _timing = Timing());
+
+  /// @brief Feed a single output report to the device
+  /// @param packet Report data without the report ID
+  /// @param replies Filled with the reports of the reply if one is due
+  /// @return Number of reply reports, 0 if no reply is due
+  size_t receive(const uint8_t *packet,
+                 std::array<Reply, maxReplyReports> &replies);
+
+  /// @brief Serial number reported on enumeration
+  inline const std::string &getSerial() const { return serial; }
+
+  /// @brief Check if the device is plugged in
+  inline bool isConnected() const { return connected; }
+
+  /// @brief Plug/unplug the device
+  inline void setConnected(bool _connected) { connected = _connected; }
+
+  /// @brief Copy of the current register values
+  Registers getRegisters();
+
+  /// @brief Number of complete messages processed
+  inline uint64_t getMessageNum() const { return messageNum; }
+
+private:
+  struct Deferred {
+    uint8_t *target;
+    uint8_t value;
+    Clock::time_point applyAt;
+  };
+
+  void update(Clock::time_point now);
+  void defer(uint8_t &target, uint8_t value, Clock::duration delay,
+             Clock::time_point now);
+  bool execute(uint8_t flags, const uint8_t *data, uint16_t length,
+               uint8_t *payload, uint16_t &payloadLength,
+               Clock::time_point now);
+  uint8_t validate();
+  void reset();
+
+  std::string serial;
+  Timing timing;
+  std::atomic<bool> connected;
+  std::atomic<uint64_t> messageNum;
+
+  Registers registers;
+  std::vector<Deferred> deferred;
+  Clock::time_point validationDoneAt;
+  uint8_t validationResult;
+  bool validated;
+
+  // message currently being reassembled from the output reports
+  uint8_t messageFlags;
+  uint8_t messageSequence;
+  uint16_t messageLength;
+  uint16_t messageReceived;
+  std::array<uint8_t, maxMessageSize> messageData;
+
+  Clock::time_point linkFreeAt;
+  Clock::time_point deviceFreeAt;
+  std::mutex mutex;
+};
+
+/// @brief Transport connected to a simulated DLPC350
+class SimTransport : public USB::Transport {
+public:
+  SimTransport(std::shared_ptr<Simulator> _simulator, std::string _path);
+
+  bool isOpen() const override;
+  void close() override;
+  inline const std::string &getPath() const override { return path; }
+  int32_t read(uint8_t *data, size_t size, int32_t timeout) override;
+  int32_t write(const uint8_t *data, size_t size) override;
+
+private:
+  std::shared_ptr<Simulator> simulator;
+  std::string path;
+  std::atomic<bool> opened;
+  USB::RingBuffer<Simulator::Reply, USB::reportQueueSize> replies;
+  std::mutex mutex;
+  std::condition_variable condition;
+};
+
+/// @brief Enumeration entry of a simulated device, mirroring hid_device_info
+struct DeviceInfo {
+  std::string path;
+  std::string serial;
+  uint16_t vendorId;
+  uint16_t productId;
+  int interfaceNumber;
+};
+
+/// @brief Simulated USB bus that simulated DLPC350s are plugged into
+class Bus {
+public:
+  explicit Bus(Timing _timing = Timing()) : timing{_timing}, nextId{0} {}
+
+  /// @brief Plug in a new simulated device
+  /// @return Reference to the simulated device
+  Simulator &add();
+
+  /// @brief Plug in several simulated devices
+  /// @param count Number of devices to add
+  void add(unsigned int count);
+
+  /// @brief Plug a device back in at the path it was unplugged from, e.g. to
+  /// simulate a brown-out. It starts with reset registers.
+  /// @param path Path of the unplugged device
+  /// @return Reference to the simulated device
+  Simulator &replug(const std::string &path);
+
+  /// @brief Unplug a simulated device. Open transports to it start failing.
+  /// @param path Path of the device
+  /// @return True if the device was found
+  bool remove(const std::string &path);
+
+  /// @brief List the plugged in devices like hid_enumerate
+  /// @return Enumeration entries of all devices
+  std::vector<DeviceInfo> enumerate();
+
+  /// @brief Open a simulated device by its path
+  /// @param path Path of the device
+  /// @return Opened transport, nullptr if no such device is plugged in
+  std::unique_ptr<USB::Transport> open(const std::string &path);
+
+  /// @brief Open all plugged in devices in enumeration order
+  /// @return Opened transports
+  std::vector<std::unique_ptr<USB::Transport>> openAll();
+
+  /// @brief Enumerator for a hot-plug monitor watching this bus
+  USB::Monitor::Enumerator getEnumerator();
+
+  /// @brief Opener for a hot-plug monitor watching this bus
+  USB::Monitor::Opener getOpener();
+
+private:
+  struct Entry {
+    DeviceInfo info;
+    std::shared_ptr<Simulator> simulator;
+  };
+
+  Timing timing;
+  unsigned int nextId;
+  std::vector<Entry> entries;
+  std::mutex mutex;
+};
+}; // namespace sim
+}; // namespace multi350
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef MULTI350_TRACE_HPP
+#define MULTI350_TRACE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace multi350 {
+
+/// @brief Single message written to or reply read from a device, as kept by
+/// the trace rings. 16 bytes, so a ring of a thread fits a few pages.
+struct TraceEvent {
+  enum class Type : uint8_t {
+    WRITE = 1,   // message written to the device
+    READ = 2,    // reply header read from the device
+    TIMEOUT = 3, // reply that did not arrive in time
+    FAILURE = 4  // read or write that failed
+  };
+
+  /// @brief Steady clock time in nanoseconds
+  int64_t time;
+  /// @brief CMD2 << 8 | CMD3 of written messages. Replies do not echo the
+  /// command, they are attributed through their sequence number on decode.
+  uint16_t command;
+  /// @brief Number of data bytes of the message or reply
+  uint16_t length;
+  /// @brief Trace id of the device, see traceDevice
+  uint8_t device;
+  Type type;
+  uint8_t sequence;
+  /// @brief Flags byte of the header
+  uint8_t flags;
+};
+
+static_assert(sizeof(TraceEvent) == 16);
+
+/// @brief Number of events kept per thread, older ones are overwritten
+constexpr size_t traceRingSize = 4096;
+
+namespace internal {
+extern std::atomic<bool> tracing;
+
+/// @brief Append an event to the ring of the calling thread
+extern void appendTrace(const TraceEvent &event);
+}; // namespace internal
+
+/// @brief Turn tracing of all devices on or off. Tracing is cheap enough to
+/// be left on: an event is a clock read and a 16 byte copy into a ring owned
+/// by the calling thread, without locks or allocation.
+/// @param enabled True to record events
+extern void setTracing(bool enabled);
+
+/// @brief Check if events are recorded
+inline bool isTracing() {
+  return internal::tracing.load(std::memory_order_relaxed);
+}
+
+/// @brief Record an event if tracing is on. Called by the message layer.
+/// @param device Trace id of the device
+/// @param type Direction or outcome
+/// @param sequence Sequence number of the header
+/// @param flags Flags byte of the header
+/// @param command Command code, 0 for replies
+/// @param length Number of data bytes
+inline void trace(uint8_t device, TraceEvent::Type type, uint8_t sequence,
+                  uint8_t flags, uint16_t command, uint16_t length) {
+  if (!isTracing())
+    return;
+
+  internal::appendTrace(TraceEvent{
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count(),
+      command, length, device, type, sequence, flags});
+}
+
+/// @brief Assign the trace id of a device. A device reconnected with the same
+/// identity gets its former id.
+/// @param identity Identity of the device, kept for decoding
+/// @return Trace id, ids past 255 share the last one
+extern uint8_t traceDevice(const std::string &identity);
+
+/// @brief Write the events of all threads to a file, to be read with
+/// TraceLog. Threads keep tracing while the rings are copied, events
+/// overwritten during the copy are left out.
+///
+/// The file starts with the magic "M350TRC" and a version byte, followed by
+/// the number of devices (2 bytes) with their identities (length byte and
+/// characters), and the number of threads (2 bytes), each with its index
+/// (2 bytes), its number of events (4 bytes) and the events with their
+/// fields in order, 16 bytes each. Multi-byte values are little endian.
+/// @param file Path of the dump
+/// @return True on success
+extern bool dumpTrace(const std::string &file);
+
+/// @brief Events of a dump written by dumpTrace
+class TraceLog {
+public:
+  /// @brief Event of the log with the thread that recorded it
+  struct Entry {
+    uint16_t thread;
+    TraceEvent event;
+  };
+
+  /// @brief Load a dump
+  /// @param file Path of the dump
+  /// @return True on success
+  bool load(const std::string &file);
+
+  /// @brief Identities of the traced devices, indexed by trace id
+  inline const std::vector<std::string> &getDevices() const { return devices; }
+
+  /// @brief Events of all threads ordered by time
+  inline const std::vector<Entry> &getEntries() const { return entries; }
+
+  /// @brief Print one line per event with the time since the first event,
+  /// thread, device, command name and the round trip of replies
+  /// @param out Stream to print to
+  void print(std::ostream &out) const;
+
+private:
+  std::vector<std::string> devices;
+  std::vector<Entry> entries;
+};
+}; // namespace multi350
+
+#endif
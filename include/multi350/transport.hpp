@@ -0,0 +1,140 @@
+#ifndef MULTI350_TRANSPORT_HPP
+#define MULTI350_TRANSPORT_HPP
+
+#include "hidapi.h"
+#include "usb.hpp"
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+
+namespace multi350 {
+namespace USB {
+
+/// @brief Fixed capacity FIFO for queued input reports. Like the input queues
+/// of the HID drivers, the oldest entry is dropped when full.
+template <typename T, size_t Capacity> class RingBuffer {
+public:
+  inline bool empty() const { return count == 0; }
+  inline size_t size() const { return count; }
+  inline T &front() { return entries[head]; }
+
+  inline void push(const T &entry) {
+    if (count == Capacity)
+      pop();
+    entries[(head + count) % Capacity] = entry;
+    ++count;
+  }
+
+  inline void pop() {
+    head = (head + 1) % Capacity;
+    --count;
+  }
+
+  inline void clear() {
+    head = 0;
+    count = 0;
+  }
+
+private:
+  std::array<T, Capacity> entries{};
+  size_t head{0};
+  size_t count{0};
+};
+
+/// @brief Report level connection to a single DLPC350. Reports written start
+/// with the report ID byte, reports read start directly with the packet.
+class Transport {
+public:
+  virtual ~Transport() = default;
+
+  /// @brief Check if the connection is open
+  /// @return True if open
+  virtual bool isOpen() const = 0;
+
+  /// @brief Close the connection
+  virtual void close() = 0;
+
+  /// @brief Path identifying the device on this transport
+  virtual const std::string &getPath() const = 0;
+
+  /// @brief Read a single input report
+  /// @param data Buffer to read into
+  /// @param size Size of the buffer
+  /// @param timeout Timeout in milliseconds
+  /// @return Number of bytes read, 0 on timeout, -1 on failure
+  virtual int32_t read(uint8_t *data, size_t size, int32_t timeout) = 0;
+
+  /// @brief Write a single output report
+  /// @param data Report to write, first byte is the report ID
+  /// @param size Size of the report
+  /// @return Number of bytes written, -1 on failure
+  virtual int32_t write(const uint8_t *data, size_t size) = 0;
+};
+
+/// @brief Transport through the hidapi library
+class HidTransport : public Transport {
+public:
+  /// @brief Take ownership of an opened HID handle
+  /// @param _handle Opened HID handle
+  /// @param _path Path used to open the handle
+  HidTransport(hid_device *_handle, std::string _path);
+  ~HidTransport() override;
+
+  /// @brief Open a HID device by its path
+  /// @param path Path reported by hid_enumerate
+  /// @return Opened transport, nullptr on failure
+  static std::unique_ptr<HidTransport> open(const char *path);
+
+  inline bool isOpen() const override { return handle != nullptr; }
+  void close() override;
+  inline const std::string &getPath() const override { return path; }
+  int32_t read(uint8_t *data, size_t size, int32_t timeout) override;
+  int32_t write(const uint8_t *data, size_t size) override;
+
+private:
+  std::atomic<hid_device *> handle; // read by isOpen on other threads
+  std::string path;
+};
+
+/// @brief In-process transport. Every written report is handed to a responder
+/// which queues the input reports to be read back. Without a responder, the
+/// header packet of every message expecting a reply is echoed back.
+class LoopbackTransport : public Transport {
+public:
+  /// @brief Called with every written report (without the report ID)
+  using Responder =
+      std::function<void(const uint8_t *packet, LoopbackTransport &loopback)>;
+
+  explicit LoopbackTransport(std::string _path = "loopback",
+                             Responder _responder = nullptr);
+
+  inline bool isOpen() const override { return opened; }
+  void close() override;
+  inline const std::string &getPath() const override { return path; }
+  int32_t read(uint8_t *data, size_t size, int32_t timeout) override;
+  int32_t write(const uint8_t *data, size_t size) override;
+
+  /// @brief Queue an input report to be read
+  /// @param packet Packet data (without the report ID)
+  /// @param size Size of the packet, at most packetSize
+  void push(const uint8_t *packet, size_t size);
+
+private:
+  void echo(const uint8_t *packet);
+
+  std::string path;
+  Responder responder;
+  std::atomic<bool> opened;
+  uint16_t continuationBytes;
+  RingBuffer<Report, reportQueueSize> reports;
+  std::mutex mutex;
+  std::condition_variable condition;
+};
+}; // namespace USB
+}; // namespace multi350
+
+#endif
@@ -1,31 +1,59 @@
 #ifndef MULTI350_USB_HPP
 #define MULTI350_USB_HPP
 
-#include "hidapi.h"
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
 #include <vector>
 
 namespace multi350 {
-namespace USB {
-/// @brief uint8_t array managed by unique pointers
-using Buffer = std::unique_ptr<uint8_t, std::default_delete<uint8_t[]>>;
+class AsyncWorker;
 
+namespace USB {
 /// @brief Vendor ID for DLPC350
 const uint16_t vendorId = 0x0451;
 
 /// @brief Product ID for DLPC350
 const uint16_t productId = 0x6401;
 
-/// @brief Current HID device used for transactions
-extern hid_device *device;
-
-/// @brief All DLPC350 devices connected via HID
-extern std::vector<hid_device *> devices;
-
 /// @brief Timeout duration for hid read in milliseconds
 const int32_t readTimeout = 2000;
 
+/// @brief Deadline class of a command, bounding how long its reply is waited
+/// for
+enum class Deadline : uint8_t {
+  SHORT,  // register reads, answered right away
+  NORMAL, // register writes and LUT uploads
+  LONG    // validation, power and display mode transitions
+};
+
+/// @brief Reply timeout of a deadline class
+/// @param deadline Deadline class
+/// @return Timeout in milliseconds
+constexpr int32_t deadlineTimeout(Deadline deadline) {
+  switch (deadline) {
+  case Deadline::SHORT:
+    return 250;
+  case Deadline::NORMAL:
+    return 1000;
+  default:
+    return readTimeout;
+  }
+}
+
+/// @brief Multiple of the usual reply latency after which a device is
+/// considered unresponsive
+constexpr int32_t watchdogFactor = 8;
+
+/// @brief Lower bound of the watchdog timeout in milliseconds
+constexpr int32_t watchdogMinimum = 50;
+
 /// @brief Maximum packet size in bytes for a single command
 constexpr size_t packetSize = 64;
 
@@ -33,6 +61,207 @@ constexpr size_t packetSize = 64;
 /// Windows internal use and it is always 0
 constexpr size_t bufferSize = packetSize + 1;
 
+/// @brief Single HID report buffer
+using Report = std::array<uint8_t, bufferSize>;
+
+/// @brief Number of input reports queued per device, matching hidraw
+constexpr size_t reportQueueSize = 64;
+
+class Transport;
+
+/// @brief Tracks the usual reply latency of a device as a moving average and
+/// cuts reply timeouts down to a few multiples of it, so a hung device is
+/// noticed long before the deadline of the command.
+class Watchdog {
+public:
+  /// @brief Timeout for the next reply. Long commands get their full deadline
+  /// unless the device already stopped replying.
+  /// @param deadline Deadline class of the command
+  /// @return Timeout in milliseconds
+  int32_t getTimeout(Deadline deadline) const;
+
+  /// @brief Record a reply, which marks the device responsive again
+  /// @param latency Time since the last write
+  /// @param deadline Deadline class of the command
+  void observe(std::chrono::microseconds latency, Deadline deadline);
+
+  /// @brief Record a reply that did not arrive in time
+  inline void expire() { responsive = false; }
+
+  /// @brief Check if the last reply arrived in time
+  inline bool isResponsive() const { return responsive; }
+
+  /// @brief Usual reply latency, zero until the first reply
+  inline std::chrono::microseconds getLatency() const {
+    return std::chrono::microseconds(latency.load());
+  }
+
+private:
+  std::atomic<int64_t> latency{0}; // microseconds
+  std::atomic<bool> responsive{true};
+};
+
+/// @brief Enumeration entry of a connected device
+struct DeviceInfo {
+  std::string path;
+  std::string serial; // empty if the device reports none
+};
+
+/// @brief Pattern sequence last uploaded to a device, as sent on the wire.
+/// Lets uploads send only the LUT entries that changed and skip validating a
+/// sequence the device holds already, and commands check the input source
+/// without reading it. Cleared when the device reconnects or
+/// a batch of writes to it fails. Only use while holding the device lock.
+struct UploadRecord {
+  /// @brief Pattern LUT entries held by the device, 3 bytes each
+  std::vector<uint8_t> patternLUT;
+  /// @brief Variable exposure pattern LUT entries, 12 bytes each
+  std::vector<uint8_t> varExpPatLUT;
+  /// @brief Sequence configuration written with the LUTs, in a layout of the
+  /// writer's choosing. Empty if unknown.
+  std::vector<uint8_t> configuration;
+  /// @brief True if the device validated the recorded sequence
+  bool validated{false};
+  /// @brief Input source register last written or read, empty if unknown
+  std::optional<uint8_t> inputSource;
+
+  inline void clear() {
+    patternLUT.clear();
+    varExpPatLUT.clear();
+    configuration.clear();
+    validated = false;
+    inputSource.reset();
+  }
+};
+
+/// @brief Handle to a single DLPC350 device. Owns the transport to the
+/// device, its own in/out report buffers and the lock serializing
+/// transactions on it, so separate devices can be driven from separate
+/// threads.
+class Device {
+public:
+  /// @brief Take ownership of an opened transport
+  /// @param _transport Transport connected to the device
+  /// @param _serial Serial number reported on enumeration, if any
+  explicit Device(std::unique_ptr<Transport> _transport,
+                  std::string _serial = "");
+  ~Device();
+
+  Device(const Device &) = delete;
+  Device &operator=(const Device &) = delete;
+
+  /// @brief Check if the transport is still open
+  /// @return True if open
+  bool isOpen() const;
+
+  /// @brief Close the transport of this device only. Waits for the running
+  /// transaction.
+  void close();
+
+  /// @brief Replace the transport of a device that went away. The slot, its
+  /// index and everything referring to the device stay valid.
+  /// @param _transport Transport connected to the same device again
+  void reconnect(std::unique_ptr<Transport> _transport);
+
+  /// @brief Path identifying the device on its transport
+  inline const std::string &getPath() const { return path; }
+
+  /// @brief Serial number reported on enumeration, empty if unknown
+  inline const std::string &getSerial() const { return serial; }
+
+  /// @brief Stable key of the device: the serial number, or the USB path for
+  /// devices without one
+  inline const std::string &getIdentity() const {
+    return serial.empty() ? path : serial;
+  }
+
+  /// @brief Id of the device in traces
+  inline uint8_t getTraceId() const { return traceId; }
+
+  /// @brief Transport used for the transactions. Only use while holding the
+  /// device lock.
+  inline Transport &getTransport() { return *transport; }
+
+  /// @brief Lock to hold for the duration of a write/read transaction
+  inline std::mutex &getMutex() { return mutex; }
+
+  /// @brief I/O thread of this device, started on first use
+  AsyncWorker &getWorker();
+
+  /// @brief Sequence number for the next message. Only call while holding
+  /// the device lock.
+  inline uint8_t nextSequence() { return ++sequence; }
+
+  /// @brief Buffer filled by read()
+  inline uint8_t *getInBuffer() { return inBuffer.data(); }
+
+  /// @brief Buffer sent by write(). First byte is the report ID and stays 0
+  inline uint8_t *getOutBuffer() { return outBuffer.data(); }
+
+  /// @brief Sequence last uploaded to this device. Only use while holding
+  /// the device lock.
+  inline UploadRecord &getUploadRecord() { return uploadRecord; }
+
+  /// @brief Latency watchdog of this device
+  inline const Watchdog &getWatchdog() const { return watchdog; }
+
+  /// @brief Check if the device replied in time to the last request
+  inline bool isResponsive() const { return watchdog.isResponsive(); }
+
+  /// @brief Discard the input reports queued after a reply timed out, so the
+  /// late reply is not taken for the answer to the next request. Does nothing
+  /// if no reply went missing.
+  /// @return Number of discarded reports
+  unsigned int drain();
+
+  /// @brief Read a single report into the in buffer
+  /// @param deadline Deadline class of the awaited reply
+  /// @return Number of bytes read, 0 on timeout, -1 on failure
+  int32_t read(Deadline deadline = Deadline::LONG);
+
+  /// @brief Write the out buffer as a single report
+  /// @return Number of bytes written, -1 on failure
+  int32_t write();
+
+private:
+  /// @brief Close the transport after a failed transaction
+  void fail();
+
+  std::unique_ptr<Transport> transport;
+  std::string path;
+  std::string serial;
+  uint8_t traceId;
+  mutable std::mutex transportMutex;
+  Report inBuffer;
+  Report outBuffer;
+  uint8_t sequence;
+  Watchdog watchdog;
+  UploadRecord uploadRecord;
+  std::chrono::steady_clock::time_point lastWrite;
+  bool stale;
+  std::mutex mutex;
+  std::unique_ptr<AsyncWorker> worker;
+  std::once_flag workerStarted;
+};
+
+/// @brief Called when the transport of a device fails and is closed. Runs on
+/// the thread of the failed transaction while holding the device lock.
+using FailureHandler = std::function<void(Device &device)>;
+
+/// @brief Add a handler notified of failed devices, e.g. to start
+/// reconnecting right away
+/// @param handler Handler to call
+/// @return Id to remove the handler with
+extern unsigned int addFailureHandler(FailureHandler handler);
+
+/// @brief Remove a handler added with addFailureHandler. Waits for a running
+/// call of the handler, so it must not be called from one.
+/// @param id Id returned when the handler was added
+extern void removeFailureHandler(unsigned int id);
+
+/// @brief All DLPC350 devices connected via HID
+extern std::vector<std::unique_ptr<Device>> devices;
+
 /// @brief Initialize the HID API for USB transactions
 /// @return True on success
 extern bool init();
@@ -41,9 +270,29 @@ extern bool init();
 /// @return True on succcess
 extern bool exit();
 
-/// @brief Open all connected DLPC350 devices
+/// @brief Backend used to open the connected devices
+enum class Backend {
+  HIDAPI, // hidapi library, one blocking read per transaction
+  HIDRAW  // Linux hidraw nodes serviced by a single epoll loop
+};
+
+/// @brief Open all connected DLPC350 devices. The devices are opened in
+/// parallel and attached in enumeration order.
+/// @param backend Backend used to open the devices
 /// @return True on success
-extern bool open();
+extern bool open(Backend backend = Backend::HIDAPI);
+
+/// @brief Find all connected DLPC350 devices (interface 0)
+/// @param backend Backend to enumerate with
+/// @return Enumeration entries of the devices
+extern std::vector<DeviceInfo> enumerate(Backend backend = Backend::HIDAPI);
+
+/// @brief Open the transport to a single device
+/// @param path Path returned by enumerate
+/// @param backend Backend the path was enumerated with
+/// @return Opened transport, nullptr on failure
+extern std::unique_ptr<Transport> openTransport(const std::string &path,
+                                                Backend backend);
 
 /// @brief Close all connections to DLPC350 devices
 extern void close();
@@ -56,23 +305,26 @@ extern bool isConnected();
 /// @return Number of connected devices
 extern unsigned int deviceNum();
 
-/// @brief Select which device to control
+/// @brief Add a device connected through an already opened transport
+/// @param transport Transport connected to the device
+/// @param serial Serial number reported on enumeration, if any
+/// @return Reference to the added device
+extern Device &attach(std::unique_ptr<Transport> transport,
+                      const std::string &serial = "");
+
+/// @brief Find the slot of a device by its path
+/// @param path Path of the device
+/// @return Index of the device, -1 if not found
+extern int findDevice(const std::string &path);
+
+/// @brief Get the handle of a connected device
 /// @param index Index of device
-/// @return True on success
-extern bool select(unsigned int index);
+/// @return Pointer to the device, nullptr if index is out of range
+extern Device *getDevice(unsigned int index);
 
 /// @brief Prints information on all connected devices
 extern void printDevices();
-
-/// @brief Read from the USB connection
-/// @return Buffer containing the  data
-extern Buffer read();
-
-/// @brief Write to the USB connection
-/// @param data Data buffer to write
-/// @return Number of bytes written
-extern int32_t write(Buffer &data);
 }; // namespace USB
 }; // namespace multi350
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,144 @@
+#include "multi350/async.hpp"
+#include <algorithm>
+#include <array>
+#include <memory>
+
+namespace multi350 {
+
+AsyncWorker::AsyncWorker(USB::Device &_device)
+    : device{_device}, running{0}, stopping{false} {
+  thread = std::thread(&AsyncWorker::run, this);
+}
+
+AsyncWorker::~AsyncWorker() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  condition.notify_all();
+  thread.join();
+}
+
+void AsyncWorker::submit(const Message &msg, Completion completion) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!stopping) {
+      jobs.push_back({msg, std::move(completion), nullptr});
+      condition.notify_all();
+      return;
+    }
+  }
+
+  if (completion)
+    completion(ReplyView());
+}
+
+void AsyncWorker::execute(std::function<void()> function) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!stopping) {
+      jobs.push_back({Message(), nullptr, std::move(function)});
+      condition.notify_all();
+      return;
+    }
+  }
+
+  function();
+}
+
+size_t AsyncWorker::getPendingNum() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return jobs.size() + running;
+}
+
+void AsyncWorker::run() {
+  std::array<Job, Pipeline::window> batch;
+  std::array<std::array<uint8_t, internal::headerSize +
+                                      internal::maxMessageDataSize>,
+             Pipeline::window>
+      replies;
+  std::array<size_t, Pipeline::window> capacities;
+  std::array<bool, Pipeline::window> received;
+
+  while (true) {
+    size_t batchSize = 0;
+    bool failAll = false;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      condition.wait(lock, [this] { return stopping || !jobs.empty(); });
+      if (jobs.empty())
+        return;
+
+      // functions run on their own, messages are batched up to the next one
+      while (!jobs.empty() && batchSize < batch.size()) {
+        if (jobs.front().function && batchSize > 0)
+          break;
+        batch[batchSize++] = std::move(jobs.front());
+        jobs.pop_front();
+        if (batch[0].function)
+          break;
+      }
+      running = batchSize;
+      failAll = stopping;
+    }
+
+    if (batch[0].function) {
+      batch[0].function();
+      batch[0].function = nullptr;
+
+      std::lock_guard<std::mutex> lock(mutex);
+      running = 0;
+      continue;
+    }
+
+    received.fill(false);
+    if (!failAll) {
+      // the whole burst is written before waiting for the first reply, the
+      // device lock is released again before calling the completions
+      Pipeline pipeline(device);
+      std::array<Pipeline::Ticket, Pipeline::window> tickets;
+      for (size_t i = 0; i < batchSize; ++i) {
+        tickets[i] = pipeline.post(batch[i].msg);
+      }
+
+      for (size_t i = 0; i < batchSize; ++i) {
+        auto reply = pipeline.collect(tickets[i]);
+        if (reply) {
+          capacities[i] = reply.getCapacity();
+          std::copy_n(reply.getPacket(), internal::headerSize + capacities[i],
+                      replies[i].data());
+          received[i] = true;
+        }
+      }
+    }
+
+    for (size_t i = 0; i < batchSize; ++i) {
+      if (batch[i].completion) {
+        batch[i].completion(received[i]
+                                ? ReplyView(replies[i].data(), capacities[i])
+                                : ReplyView());
+      }
+      batch[i].completion = nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    running = 0;
+  }
+}
+
+void transactAsync(USB::Device &device, const Message &msg,
+                   AsyncWorker::Completion completion) {
+  device.getWorker().submit(msg, std::move(completion));
+}
+
+std::future<bool> transactAsync(USB::Device &device, const Message &msg) {
+  auto promise = std::make_shared<std::promise<bool>>();
+  auto future = promise->get_future();
+
+  transactAsync(device, msg, [promise](ReplyView reply) {
+    promise->set_value(static_cast<bool>(reply));
+  });
+
+  return future;
+}
+}; // namespace multi350
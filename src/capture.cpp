@@ -0,0 +1,338 @@
+#include "multi350/capture.hpp"
+#include "multi350/commands.hpp"
+#include "multi350/log.hpp"
+#include <cstring>
+#include <iomanip>
+#include <thread>
+
+namespace multi350 {
+namespace USB {
+
+namespace {
+constexpr char magic[] = "M350CAP";
+constexpr uint8_t version = 1;
+constexpr uint8_t deviceRecord = 0;
+constexpr size_t headerBytes = 4;
+
+template <typename T> void put(std::ostream &stream, T value) {
+  for (size_t i = 0; i < sizeof(T); ++i) {
+    stream.put(static_cast<char>((value >> (8 * i)) & 0xFF));
+  }
+}
+
+template <typename T> bool get(std::istream &stream, T &value) {
+  value = 0;
+  for (size_t i = 0; i < sizeof(T); ++i) {
+    int byte = stream.get();
+    if (byte == EOF)
+      return false;
+    value |= static_cast<T>(byte) << (8 * i);
+  }
+  return true;
+}
+} // namespace
+
+static std::atomic<Recorder *> activeRecorder{nullptr};
+
+void setRecorder(Recorder *recorder) { activeRecorder = recorder; }
+
+Recorder *getRecorder() { return activeRecorder; }
+
+Recorder::~Recorder() {
+  // make sure no device reports to a destroyed recorder
+  Recorder *self = this;
+  activeRecorder.compare_exchange_strong(self, nullptr);
+  close();
+}
+
+bool Recorder::open(const std::string &file) {
+  std::lock_guard<std::mutex> lock(mutex);
+  stream.close();
+  stream.open(file, std::ios::binary | std::ios::trunc);
+  if (!stream) {
+    logError() << "[Recorder] Unable to write " << file;
+    return false;
+  }
+
+  stream.write(magic, sizeof(magic) - 1);
+  stream.put(static_cast<char>(version));
+  start = std::chrono::steady_clock::now();
+  states.clear();
+  return true;
+}
+
+void Recorder::close() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (stream.is_open())
+    stream.close();
+}
+
+Recorder::DeviceState &Recorder::getState(const Device &device) {
+  auto found = states.find(&device);
+  if (found != states.end())
+    return found->second;
+
+  auto &state = states[&device];
+  state.id = static_cast<uint8_t>(states.size() - 1);
+
+  auto &identity = device.getIdentity();
+  auto length = std::min<size_t>(identity.size(), 255);
+  stream.put(static_cast<char>(deviceRecord));
+  stream.put(static_cast<char>(state.id));
+  stream.put(static_cast<char>(length));
+  stream.write(identity.data(), length);
+  return state;
+}
+
+void Recorder::record(const Device &device, CaptureEntry::Type type,
+                      const uint8_t *packet, size_t size) {
+  auto time = std::chrono::steady_clock::now() - start;
+  size = std::min(size, packetSize);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!stream.is_open())
+    return;
+
+  auto &state = getState(device);
+  // timeouts and failures are charged to the last message written
+  uint16_t command = state.messages.command;
+  if (type == CaptureEntry::Type::WRITE && size >= headerBytes + 2) {
+    state.messages.write(packet);
+    command = state.messages.command;
+  } else if (type == CaptureEntry::Type::READ && size >= headerBytes) {
+    state.messages.read(packet);
+    command = state.messages.replyCommand;
+  }
+
+  // replies are mostly padding
+  size_t stored = size;
+  while (stored > 0 && packet[stored - 1] == 0) {
+    --stored;
+  }
+
+  stream.put(static_cast<char>(type));
+  stream.put(static_cast<char>(state.id));
+  put<uint64_t>(stream,
+                std::chrono::duration_cast<std::chrono::nanoseconds>(time)
+                    .count());
+  put<uint16_t>(stream, command);
+  stream.put(static_cast<char>(size));
+  stream.put(static_cast<char>(stored));
+  stream.write(reinterpret_cast<const char *>(packet), stored);
+}
+
+bool Capture::load(const std::string &file) {
+  std::ifstream stream(file, std::ios::binary);
+  if (!stream) {
+    logError() << "[Capture] Unable to read " << file;
+    return false;
+  }
+
+  char header[sizeof(magic)] = {};
+  stream.read(header, sizeof(magic) - 1);
+  if (!stream || memcmp(header, magic, sizeof(magic) - 1) != 0 ||
+      stream.get() != version) {
+    logError() << "[Capture] Not a capture: " << file;
+    return false;
+  }
+
+  devices.clear();
+  entries.clear();
+  for (int kind = stream.get(); kind != EOF; kind = stream.get()) {
+    if (kind == deviceRecord) {
+      uint8_t id, length;
+      std::string identity;
+      if (get(stream, id) && get(stream, length)) {
+        identity.resize(length);
+        stream.read(identity.data(), length);
+      }
+      if (!stream || id != devices.size()) {
+        logError() << "[Capture] Malformed device record";
+        return false;
+      }
+      devices.push_back(std::move(identity));
+      continue;
+    }
+
+    CaptureEntry entry{};
+    uint64_t time;
+    uint8_t stored;
+    entry.type = static_cast<CaptureEntry::Type>(kind);
+    if (kind > static_cast<int>(CaptureEntry::Type::FAILURE) ||
+        !get(stream, entry.device) || !get(stream, time) ||
+        !get(stream, entry.command) || !get(stream, entry.size) ||
+        !get(stream, stored) || stored > packetSize ||
+        entry.device >= devices.size()) {
+      logError() << "[Capture] Malformed entry " << entries.size();
+      return false;
+    }
+    stream.read(reinterpret_cast<char *>(entry.packet.data()), stored);
+    if (!stream) {
+      logError() << "[Capture] Truncated entry " << entries.size();
+      return false;
+    }
+    entry.time = std::chrono::nanoseconds(time);
+    entries.push_back(entry);
+  }
+
+  return true;
+}
+
+void Capture::printSummary(std::ostream &out) const {
+  struct Stats {
+    unsigned int count{0};
+    unsigned int timeouts{0};
+    std::chrono::nanoseconds total{0};
+    std::chrono::nanoseconds max{0};
+  };
+
+  // round trip from the header of a request to the reply with its sequence
+  std::vector<std::array<std::chrono::nanoseconds, 256>> sent(devices.size());
+  std::vector<std::map<uint16_t, Stats>> stats(devices.size());
+  std::vector<internal::MessageTracker> messages(devices.size());
+  for (auto &entry : entries) {
+    auto &device = entry.device;
+    if (entry.type == CaptureEntry::Type::WRITE) {
+      if (messages[device].write(entry.packet.data()))
+        sent[device][entry.packet[1]] = entry.time;
+    } else if (entry.type == CaptureEntry::Type::READ) {
+      // continuations of a long reply are part of its round trip
+      if (!messages[device].read(entry.packet.data()))
+        continue;
+      auto latency = entry.time - sent[device][entry.packet[1]];
+      auto &command = stats[device][entry.command];
+      ++command.count;
+      command.total += latency;
+      command.max = std::max(command.max, latency);
+    } else if (entry.type == CaptureEntry::Type::TIMEOUT) {
+      ++stats[device][entry.command].timeouts;
+    }
+  }
+
+  auto duration =
+      entries.empty() ? std::chrono::nanoseconds(0) : entries.back().time;
+  out << "[Capture] " << entries.size() << " reports over "
+      << std::chrono::duration_cast<std::chrono::milliseconds>(duration).count()
+      << "ms" << std::endl;
+
+  for (size_t i = 0; i < devices.size(); ++i) {
+    std::vector<std::pair<uint16_t, Stats>> commands(stats[i].begin(),
+                                                     stats[i].end());
+    std::sort(commands.begin(), commands.end(), [](auto &a, auto &b) {
+      return a.second.total > b.second.total;
+    });
+
+    // the rest of the session is spent outside the device
+    std::chrono::nanoseconds waiting{0};
+    for (auto &[command, commandStats] : commands) {
+      waiting += commandStats.total;
+    }
+    out << "Device " << devices[i] << ": "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(waiting)
+               .count()
+        << "ms waiting for replies" << std::endl;
+    for (auto &[command, commandStats] : commands) {
+      auto average = commandStats.count > 0
+                         ? commandStats.total / commandStats.count
+                         : std::chrono::nanoseconds(0);
+      auto *info = findCommand(command);
+      out << "  " << (info != nullptr ? info->name : "Unknown") << " (CMD2 0x"
+          << std::hex << std::setfill('0') << std::setw(2) << (command >> 8)
+          << " CMD3 0x" << std::setw(2) << (command & 0xFF) << std::dec
+          << std::setfill(' ') << "): " << commandStats.count
+          << " replies, " << commandStats.timeouts << " timeouts, total "
+          << commandStats.total.count() / 1000 << "us, avg "
+          << average.count() / 1000 << "us, max "
+          << commandStats.max.count() / 1000 << "us" << std::endl;
+    }
+  }
+}
+
+ReplayTransport::ReplayTransport(std::shared_ptr<const Capture> _capture,
+                                 const std::string &identity, bool _realTime)
+    : capture{std::move(_capture)}, path{"replay:" + identity},
+      realTime{_realTime}, opened{true}, position{0}, capturedWrite{0},
+      divergences{0} {
+  auto &devices = capture->getDevices();
+  auto found = std::find(devices.begin(), devices.end(), identity);
+  if (found == devices.end()) {
+    logError() << "[Replay] Device not in capture: " << identity;
+    opened = false;
+    return;
+  }
+
+  auto id = static_cast<uint8_t>(found - devices.begin());
+  auto &captured = capture->getEntries();
+  for (size_t i = 0; i < captured.size(); ++i) {
+    if (captured[i].device == id)
+      entries.push_back(i);
+  }
+}
+
+int32_t ReplayTransport::read(uint8_t *data, size_t size, int32_t timeout) {
+  if (!opened)
+    return -1;
+  if (position == entries.size()) {
+    logWarning() << "[Replay] End of capture: " << path;
+    opened = false;
+    return -1;
+  }
+
+  // the library reads more than it did when captured
+  auto &entry = capture->getEntries()[entries[position]];
+  if (entry.type == CaptureEntry::Type::WRITE)
+    return 0;
+  ++position;
+
+  if (realTime) {
+    auto latency = std::min<std::chrono::nanoseconds>(
+        entry.time - capturedWrite, std::chrono::milliseconds(timeout));
+    std::this_thread::sleep_until(lastWrite + latency);
+  }
+
+  switch (entry.type) {
+  case CaptureEntry::Type::READ: {
+    auto readBytes = std::min<size_t>(entry.size, size);
+    memcpy(data, entry.packet.data(), readBytes);
+    return static_cast<int32_t>(readBytes);
+  }
+  case CaptureEntry::Type::TIMEOUT:
+    return 0;
+  default:
+    opened = false;
+    return -1;
+  }
+}
+
+int32_t ReplayTransport::write(const uint8_t *data, size_t size) {
+  if (!opened || size == 0)
+    return -1;
+
+  // replies of the capture the library did not read are skipped
+  auto &captured = capture->getEntries();
+  while (position < entries.size() &&
+         captured[entries[position]].type != CaptureEntry::Type::WRITE) {
+    ++position;
+  }
+  if (position == entries.size()) {
+    logWarning() << "[Replay] End of capture: " << path;
+    opened = false;
+    return -1;
+  }
+
+  auto &entry = captured[entries[position++]];
+  size_t compared = std::min<size_t>(size - 1, packetSize);
+  if (memcmp(data + 1, entry.packet.data(), compared) != 0) {
+    if (divergences++ == 0) {
+      logWarning()
+          << "[Replay] Written report differs from the capture at entry "
+          << entries[position - 1] << ": " << path;
+    }
+  }
+
+  capturedWrite = entry.time;
+  lastWrite = std::chrono::steady_clock::now();
+  return static_cast<int32_t>(size);
+}
+}; // namespace USB
+}; // namespace multi350
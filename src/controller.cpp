@@ -1,67 +1,294 @@
 #include "multi350/controller.hpp"
+#include "multi350/commands.hpp"
+#include "multi350/dlpc350_async.hpp"
+#include "multi350/log.hpp"
+#include <algorithm>
 #include <cassert>
 #include <chrono>
+#include <filesystem>
+#include <future>
 #include <iostream>
+#include <limits>
+#include <numeric>
 #include <thread>
 
 using namespace std::chrono_literals;
 
 namespace multi350 {
 
-bool Controller::open() {
-  if (!USB::open()) {
-    std::cerr << "[Controller] Unable to open devices" << std::endl;
+bool Controller::open(USB::Backend backend) {
+  Controller::stopMonitor();
+  if (!USB::open(backend)) {
+    logError() << "[Controller] Unable to open devices";
     return false;
   }
 
-  for (int i = 0; i < deviceNum(); ++i) {
-    projectors.emplace_back(i);
+  return Controller::setupProjectors();
+}
+
+bool Controller::open(std::vector<std::unique_ptr<USB::Transport>> transports) {
+  if (transports.empty()) {
+    logError() << "[Controller] No transports to open";
+    return false;
+  }
+
+  Controller::stopMonitor();
+  USB::close();
+  for (auto &transport : transports) {
+    USB::attach(std::move(transport));
+  }
+
+  return Controller::setupProjectors();
+}
+
+bool Controller::setIdentityFile(const std::string &file) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  identityFile = file;
+  identities.clear();
+
+  // a missing file just means no projector is known yet
+  if (!std::filesystem::exists(file))
+    return true;
+
+  return identities.load(file);
+}
+
+bool Controller::setupProjectors() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  projectors.clear();
+
+  // known devices in their stored order, new ones after in enumeration order
+  std::vector<unsigned int> slots(deviceNum());
+  std::iota(slots.begin(), slots.end(), 0);
+  auto logicalIndex = [this](unsigned int slot) {
+    auto *device = USB::getDevice(slot);
+    auto index = device ? identities.get(device->getIdentity()) : std::nullopt;
+    return index.value_or(std::numeric_limits<unsigned int>::max());
+  };
+  std::stable_sort(slots.begin(), slots.end(),
+                   [&logicalIndex](unsigned int a, unsigned int b) {
+                     return logicalIndex(a) < logicalIndex(b);
+                   });
+
+  for (auto slot : slots) {
+    projectors.emplace_back(slot);
   }
+  Controller::storeIdentities();
 
   Controller::sync();
 
-  std::cout << "[Controller] Opening device connections: " << deviceNum()
-            << std::endl;
+  logInfo() << "[Controller] Opening device connections: " << deviceNum();
 
   return true;
 }
 
 void Controller::close() {
-  std::cout << "[Controller] Closing device connections" << std::endl;
+  logInfo() << "[Controller] Closing device connections";
+  Controller::stopMonitor();
+
+  std::lock_guard<std::recursive_mutex> lock(mutex);
   projectors.clear();
   USB::close();
 }
 
+bool Controller::startMonitor(USB::Backend backend) {
+  return Controller::startMonitor(
+      [backend] { return USB::enumerate(backend); },
+      [backend](const std::string &path) {
+        return USB::openTransport(path, backend);
+      });
+}
+
+bool Controller::startMonitor(USB::Monitor::Enumerator enumerator,
+                              USB::Monitor::Opener opener) {
+  Controller::stopMonitor();
+
+  monitor = std::make_unique<USB::Monitor>(
+      std::move(enumerator), std::move(opener),
+      [this](USB::DeviceEvent event, unsigned int index) {
+        Controller::onDeviceEvent(event, index);
+      });
+
+  logInfo() << "[Controller] Hot-plug monitor started";
+  return true;
+}
+
+void Controller::stopMonitor() {
+  // not under the lock, the monitor thread takes it to report events
+  monitor.reset();
+}
+
+void Controller::onDeviceEvent(USB::DeviceEvent event, unsigned int index) {
+  Projector replayed;
+  {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    if (event == USB::DeviceEvent::ADDED) {
+      auto &projector = projectors.emplace_back(index);
+      Controller::storeIdentities();
+      Controller::syncSingle(projector);
+      logInfo() << "[Controller] Projector added: " << index;
+      return;
+    }
+
+    auto *projector = Controller::findProjector(index);
+    if (!projector)
+      return;
+
+    if (event == USB::DeviceEvent::REMOVED) {
+      projector->connected = false;
+      logInfo() << "[Controller] Projector disconnected: " << index;
+      return;
+    }
+
+    projector->connected = true;
+    logInfo() << "[Controller] Projector reconnected: " << index;
+    replayed = *projector;
+  }
+
+  // waking from standby alone takes seconds, the other projectors are driven
+  // meanwhile
+  if (!Controller::replaySingle(replayed)) {
+    logError() << "[Controller] Failed to restore projector " << index;
+  }
+
+  Controller::updateProjector(index, [&replayed](Projector &projector) {
+    projector.hardwareStatus = replayed.hardwareStatus;
+    projector.systemStatus = replayed.systemStatus;
+    projector.mainStatus = replayed.mainStatus;
+  });
+}
+
 void Controller::sync() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
   if (projectors.empty()) {
-    std::cout << "[Controller] No projectors connected" << std::endl;
+    logInfo() << "[Controller] No projectors connected";
     return;
   }
 
+  // projectors only share the controller, so they are synced in parallel
+  std::vector<std::future<bool>> syncing;
+  for (auto &projector : projectors) {
+    syncing.push_back(std::async(std::launch::async, [this, &projector] {
+      return Controller::syncSingle(projector);
+    }));
+  }
+
+  for (auto &result : syncing) {
+    result.wait();
+  }
+}
+
+void Controller::storeIdentities() {
+  for (unsigned int i = 0; i < projectors.size(); ++i) {
+    if (auto *device = USB::getDevice(projectors[i].index))
+      identities.set(device->getIdentity(), i);
+  }
+
+  if (!identityFile.empty())
+    identities.save(identityFile);
+}
+
+bool Controller::syncSingle(Projector &projector) {
+  auto *device = USB::getDevice(projector.index);
+  if (!device)
+    return false;
+
+  auto snapshot = multi350::readSnapshot(*device);
+  if (!snapshot) {
+    logError() << "[Controller] Failed to sync projector " << projector.index
+               << ": " << getErrorName(snapshot.error());
+    return false;
+  }
+
+  projector.powerMode = snapshot->powerMode;
+  projector.ledCurrent = snapshot->ledCurrent;
+  projector.displayMode = snapshot->displayMode;
+  projector.patternStatus = snapshot->patternStatus;
+  projector.hardwareStatus = snapshot->hardwareStatus;
+  projector.systemStatus = snapshot->systemStatus;
+  projector.mainStatus = snapshot->mainStatus;
+  projector.snapshotLatency = snapshot->latency;
+  logDebug() << "[Controller] Synced projector " << projector.index << " in "
+             << snapshot->latency.count() << "us";
+  return true;
+}
+
+Projector *Controller::findProjector(unsigned int index) {
   for (auto &projector : projectors) {
-    USB::select(projector.index);
+    if (projector.index == index)
+      return &projector;
+  }
+  return nullptr;
+}
 
-    projector.powerMode = *multi350::getPowerMode();
-    projector.ledCurrent = *multi350::getLEDCurrent();
-    projector.displayMode = *multi350::getDisplayMode();
-    projector.patternStatus = *multi350::getPatternStatus();
+bool Controller::isAvailable(Projector &projector) {
+  auto *device = USB::getDevice(projector.index);
+  if (device && device->isOpen())
+    return true;
 
-    projector.hardwareStatus = *multi350::getHardwareStatus();
-    projector.systemStatus = *multi350::getSystemStatus();
-    projector.mainStatus = *multi350::getMainStatus();
+  if (projector.connected) {
+    logWarning() << "[Controller] Projector " << projector.index
+                 << " is disconnected, skipping it until it reconnects";
   }
+  projector.connected = false;
+  return false;
+}
+
+bool Controller::replaySingle(Projector &projector) {
+  auto *device = USB::getDevice(projector.index);
+  if (!device)
+    return false;
+
+  auto powerMode = multi350::getPowerMode(*device);
+  if (!powerMode)
+    return false;
+
+  if (*powerMode != projector.powerMode) {
+    if (!multi350::setPowerMode(*device, projector.powerMode))
+      return false;
+    if (projector.powerMode == PowerMode::STANDBY)
+      return true;
+    std::this_thread::sleep_for(2000ms);
+  } else if (projector.powerMode == PowerMode::STANDBY) {
+    return true;
+  }
+
+  auto &ledCurrent = projector.ledCurrent;
+  if (!multi350::setLEDCurrent(*device, ledCurrent.red, ledCurrent.green,
+                               ledCurrent.blue)) {
+    return false;
+  }
+
+  bool result;
+  if (projector.patternStatus == PatternStatus::START &&
+      projector.patternSequence) {
+    result = Controller::startPatternSequenceSingle(
+        *device, *projector.patternSequence);
+  } else if (projector.patternStatus == PatternStatus::START &&
+             projector.varExpPatSequence) {
+    result = Controller::startVarExpPatSequenceSingle(
+        *device, *projector.varExpPatSequence);
+  } else {
+    result = Controller::setDisplayModeSingle(*device, projector.displayMode);
+  }
+
+  multi350::getStatus(*device, projector.hardwareStatus,
+                      projector.systemStatus, projector.mainStatus);
+  return result;
 }
 
 void Controller::controlAll() {
-  std::cout << "[Controller] Controlling all projectors" << std::endl;
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  logInfo() << "[Controller] Controlling all projectors";
   for (auto &projector : projectors) {
     projector.controlled = true;
   }
 }
 
 void Controller::controlSingle(unsigned int index) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
   assert(index < deviceNum());
-  std::cout << "[Controller] Controlling projector " << index << std::endl;
+  logInfo() << "[Controller] Controlling projector " << index;
   for (unsigned int i = 0; i < projectors.size(); ++i) {
     if (i == index) {
       projectors[i].controlled = true;
@@ -72,74 +299,123 @@ void Controller::controlSingle(unsigned int index) {
 }
 
 bool Controller::updateIndices(const std::vector<unsigned int> &indices) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
   if (indices.size() != Controller::deviceNum()) {
-    std::cerr << "[Controller] indices don't match connected devices"
-              << std::endl;
+    logError() << "[Controller] indices don't match connected devices";
     return false;
   }
 
   for (unsigned int i = 0; i < indices.size(); ++i) {
     projectors[i].index = indices[i];
   }
+  Controller::storeIdentities();
 
   return true;
 }
 
 // TODO: use expected or optional to handle error cases
 Projector &Controller::getProjector(unsigned int index) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
   assert(index < deviceNum());
   return projectors[index];
 }
 
 bool Controller::softwareReset() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
   if (projectors.empty()) {
-    std::cout << "[Controller] No projectors connected" << std::endl;
+    logInfo() << "[Controller] No projectors connected";
     return false;
   }
 
+  bool result = true;
   for (auto &projector : projectors) {
-    if (projector.controlled) {
-      USB::select(projector.index);
-
-      if (!multi350::softwareReset()) {
-        std::cerr << "[Controller] Unable to send reset message" << std::endl;
-        return false;
+    if (projector.controlled && Controller::isAvailable(projector)) {
+      auto *device = USB::getDevice(projector.index);
+      if (!device)
+        continue;
+
+      if (!multi350::softwareReset(*device)) {
+        logError() << "[Controller] Unable to send reset message";
+        result = false;
+        continue;
       }
     }
   }
 
-  return true;
+  return result;
 }
 
-void Controller::updateStatus() {
+bool Controller::snapshot() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
   if (projectors.empty()) {
-    std::cout << "[Controller] No projectors connected" << std::endl;
-    return;
+    logInfo() << "[Controller] No projectors connected";
+    return true;
   }
 
+  std::vector<std::future<bool>> reading;
   for (auto &projector : projectors) {
-    if (projector.controlled) {
-      USB::select(projector.index);
+    if (projector.controlled && Controller::isAvailable(projector)) {
+      reading.push_back(std::async(std::launch::async, [this, &projector] {
+        return Controller::syncSingle(projector);
+      }));
+    }
+  }
+
+  bool result = true;
+  for (auto &read : reading) {
+    result = read.get() && result;
+  }
+  return result;
+}
 
-      projector.hardwareStatus = *multi350::getHardwareStatus();
-      projector.systemStatus = *multi350::getSystemStatus();
-      projector.mainStatus = *multi350::getMainStatus();
+bool Controller::updateStatus() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
+  if (projectors.empty()) {
+    logInfo() << "[Controller] No projectors connected";
+    return true;
+  }
+
+  bool result = true;
+  for (auto &projector : projectors) {
+    if (projector.controlled && Controller::isAvailable(projector)) {
+      auto *device = USB::getDevice(projector.index);
+      if (!device)
+        continue;
+
+      auto status = multi350::readStatus(*device);
+      if (!status) {
+        logError() << "[Controller] Failed to update status of projector "
+                   << projector.index << ": " << getErrorName(status.error());
+        result = false;
+        continue;
+      }
+
+      projector.hardwareStatus = status->hardware;
+      projector.systemStatus = status->system;
+      projector.mainStatus = status->main;
     }
   }
+  return result;
 }
 
 bool Controller::setPowerMode(PowerMode powerMode) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
   if (projectors.empty()) {
-    std::cout << "[Controller] No projectors connected" << std::endl;
+    logInfo() << "[Controller] No projectors connected";
     return true;
   }
 
+  bool result = true;
   for (auto &projector : projectors) {
-    if (projector.controlled) {
-      USB::select(projector.index);
-      if (!multi350::setPowerMode(powerMode)) {
-        std::cerr << "[Controller] Failed to set power mode" << std::endl;
-        return false;
+    if (projector.controlled && Controller::isAvailable(projector)) {
+      auto *device = USB::getDevice(projector.index);
+      if (!device)
+        continue;
+
+      if (!multi350::setPowerMode(*device, powerMode)) {
+        logError() << "[Controller] Failed to set power mode";
+        result = false;
+        continue;
       }
       projector.powerMode = powerMode;
     }
@@ -147,112 +423,141 @@ bool Controller::setPowerMode(PowerMode powerMode) {
 
   std::this_thread::sleep_for(2000ms);
 
-  std::cout << "[Controller] Set Power Mode: "
-            << ((powerMode == PowerMode::NORMAL) ? "Normal" : "Standby")
-            << std::endl;
+  logInfo() << "[Controller] Set Power Mode: "
+            << ((powerMode == PowerMode::NORMAL) ? "Normal" : "Standby");
 
-  return true;
+  return result;
 }
 
 bool Controller::setPowerMode(unsigned int index, PowerMode powerMode) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
   if (projectors.empty()) {
-    std::cout << "[Controller] No projectors connected" << std::endl;
+    logInfo() << "[Controller] No projectors connected";
     return true;
   }
 
   assert(index < deviceNum());
   auto &projector = projectors[index];
+  if (!Controller::isAvailable(projector))
+    return false;
 
-  USB::select(projector.index);
-  if (!multi350::setPowerMode(powerMode)) {
-    std::cerr << "[Controller] Failed to set power mode" << std::endl;
+  auto *device = USB::getDevice(projector.index);
+  if (!device)
+    return false;
+
+  if (!multi350::setPowerMode(*device, powerMode)) {
+    logError() << "[Controller] Failed to set power mode";
     return false;
   }
   projector.powerMode = powerMode;
 
   std::this_thread::sleep_for(2000ms);
 
-  std::cout << "[Controller] Set Power Mode: "
-            << ((powerMode == PowerMode::NORMAL) ? "Normal" : "Standby")
-            << std::endl;
+  logInfo() << "[Controller] Set Power Mode: "
+            << ((powerMode == PowerMode::NORMAL) ? "Normal" : "Standby");
 
   return true;
 }
 
 bool Controller::startTestPattern(TestPattern testType) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
   if (projectors.empty()) {
-    std::cout << "[Controller] No projectors connected" << std::endl;
+    logInfo() << "[Controller] No projectors connected";
     return true;
   }
 
+  bool result = true;
   for (auto &projector : projectors) {
-    if (projector.controlled) {
-      USB::select(projector.index);
-      if (!multi350::setTestPattern(testType)) {
-        std::cerr << "[Controller] Failed to set test pattern" << std::endl;
-        return false;
-      }
-      if (!multi350::setInputSource(InputType::TEST_PATTERN,
+    if (projector.controlled && Controller::isAvailable(projector)) {
+      auto *device = USB::getDevice(projector.index);
+      if (!device)
+        continue;
+
+      // the test pattern is only set once it is the input source
+      if (!multi350::setInputSource(*device, InputType::TEST_PATTERN,
                                     InputBitDepth::INTERNAL)) {
-        std::cerr << "[Controller] Failed to set input source to test pattern"
-                  << std::endl;
-        return false;
+        logError() << "[Controller] Failed to set input source to test pattern";
+        result = false;
+        continue;
+      }
+      if (!multi350::setTestPattern(*device, testType)) {
+        logError() << "[Controller] Failed to set test pattern";
+        result = false;
+        continue;
       }
     }
   }
 
-  return true;
+  return result;
 }
 
 bool Controller::stopTestPattern() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
   if (projectors.empty()) {
-    std::cout << "[Controller] No projectors connected" << std::endl;
+    logInfo() << "[Controller] No projectors connected";
     return true;
   }
 
+  bool result = true;
   for (auto &projector : projectors) {
-    if (projector.controlled) {
-      USB::select(projector.index);
-      if (!multi350::setInputSource(InputType::PARALLEL,
+    if (projector.controlled && Controller::isAvailable(projector)) {
+      auto *device = USB::getDevice(projector.index);
+      if (!device)
+        continue;
+
+      if (!multi350::setInputSource(*device, InputType::PARALLEL,
                                     InputBitDepth::BITS24)) {
-        std::cerr << "[Controller] Failed to set input source to parallel 24bit"
-                  << std::endl;
-        return false;
+        logError()
+            << "[Controller] Failed to set input source to parallel 24bit";
+        result = false;
+        continue;
       }
     }
   }
 
-  return true;
+  return result;
 }
 
 bool Controller::setDisplayMode(DisplayMode displayMode) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
   if (projectors.empty()) {
-    std::cout << "[Controller] No projectors connected" << std::endl;
+    logInfo() << "[Controller] No projectors connected";
     return true;
   }
 
+  bool result = true;
   for (auto &projector : projectors) {
-    if (projector.controlled) {
-      USB::select(projector.index);
-      if (!Controller::setDisplayModeSingle(displayMode)) {
-        std::cerr << "[Controller] Failed to set display mode" << std::endl;
-        return false;
+    if (projector.controlled && Controller::isAvailable(projector)) {
+      auto *device = USB::getDevice(projector.index);
+      if (!device)
+        continue;
+
+      if (!Controller::setDisplayModeSingle(*device, displayMode)) {
+        logError() << "[Controller] Failed to set display mode";
+        result = false;
+        continue;
       }
       projector.displayMode = displayMode;
     }
   }
 
-  return true;
+  return result;
 }
 
-bool Controller::setDisplayModeSingle(DisplayMode displayMode) {
-  auto currentDisplayMode = multi350::getDisplayMode();
+bool Controller::setDisplayModeSingle(USB::Device &device,
+                                      DisplayMode displayMode) {
+  auto currentDisplayMode = multi350::getDisplayMode(device);
+  if (!currentDisplayMode)
+    return false;
 
   // If device is already in pattern mode, stop sequence
   if (*currentDisplayMode == DisplayMode::PATTERN) {
-    auto patternStatus = multi350::getPatternStatus();
+    auto patternStatus = multi350::getPatternStatus(device);
+    if (!patternStatus)
+      return false;
+
     if (*patternStatus != PatternStatus::STOP) {
-      if (!Controller::setPatternStatusSingle(PatternStatus::STOP)) {
+      if (!Controller::setPatternStatusSingle(device, PatternStatus::STOP)) {
         return false;
       }
     }
@@ -262,224 +567,278 @@ bool Controller::setDisplayModeSingle(DisplayMode displayMode) {
     return true;
   }
 
-  multi350::setDisplayMode(displayMode);
+  multi350::setDisplayMode(device, displayMode);
 
-  for (int i = 0; i < maxRetries; ++i) {
+  // a closed device will not come around, so stop retrying
+  for (int i = 0; i < maxRetries && device.isOpen(); ++i) {
     std::this_thread::sleep_for(100ms);
 
-    auto newDisplayMode = multi350::getDisplayMode();
-    if (*newDisplayMode == displayMode) {
+    auto newDisplayMode = multi350::getDisplayMode(device);
+    if (newDisplayMode && *newDisplayMode == displayMode) {
       return true;
     }
   }
 
-  std::cerr << "[Controller] Exceeded max retries on display mode change"
-            << std::endl;
+  logError() << "[Controller] Exceeded max retries on display mode change";
   return false;
 }
 
 bool Controller::startVideoMode() {
-  std::cout << "[Controller] Set display mode: Video" << std::endl;
+  logInfo() << "[Controller] Set display mode: Video";
   return Controller::setDisplayMode(DisplayMode::VIDEO);
 }
 
 bool Controller::startPatternSequence(PatternSequence &patternSequence) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
   if (projectors.empty()) {
-    std::cout << "[Controller] No projectors connected" << std::endl;
+    logInfo() << "[Controller] No projectors connected";
     return true;
   }
 
+  // kept for replaying the sequence after a reconnect
+  auto sequence = std::make_shared<PatternSequence>(patternSequence);
+  bool result = true;
   for (auto &projector : projectors) {
-    if (projector.controlled) {
-      USB::select(projector.index);
-      if (!Controller::startPatternSequenceSingle(patternSequence)) {
-        std::cerr << "[Controller] Failed to start pattern sequence"
-                  << std::endl;
-        return false;
+    if (projector.controlled && Controller::isAvailable(projector)) {
+      auto *device = USB::getDevice(projector.index);
+      if (!device)
+        continue;
+
+      if (!Controller::startPatternSequenceSingle(*device, patternSequence)) {
+        logError() << "[Controller] Failed to start pattern sequence";
+        result = false;
+        continue;
       }
       projector.patternStatus = PatternStatus::START;
+      projector.patternSequence = sequence;
+      projector.varExpPatSequence.reset();
     }
   }
 
-  std::cout << "[Controller] Set display mode: Pattern" << std::endl;
-  return true;
+  logInfo() << "[Controller] Set display mode: Pattern";
+  return result;
 }
 
-bool Controller::startPatternSequenceSingle(PatternSequence &patternSequence) {
-  if (!Controller::setDisplayModeSingle(DisplayMode::PATTERN)) {
+bool Controller::startPatternSequenceSingle(USB::Device &device,
+                                            PatternSequence &patternSequence) {
+  if (!Controller::setDisplayModeSingle(device, DisplayMode::PATTERN)) {
     return false;
   }
 
-  if (!multi350::setPatternDataSource(PatternDataSource::EXTERNAL)) {
-    std::cerr << "[Controller] Failed to set pattern data source" << std::endl;
-    return false;
-  }
-
-  if (!multi350::configurePatternSequence(patternSequence)) {
-    std::cerr << "[Controller] Failed to configure pattern sequence"
-              << std::endl;
+  bool changed = false;
+  if (!Controller::configurePatternSequenceSingle(device, patternSequence,
+                                                  changed)) {
     return false;
   }
 
-  if (!multi350::setPatternTriggerMode(PatternTriggerMode::MODE0)) {
-    std::cerr << "[Controller] Failed to set pattern trigger mode" << std::endl;
+  if (changed && !Controller::validatePatternSequenceSingle(device)) {
     return false;
   }
 
-  if (!multi350::setPatternPeriod(patternSequence.getExposure(),
-                                  patternSequence.getPeriod())) {
-    std::cerr << "[Controller] Failed to set pattern period" << std::endl;
-    return false;
-  }
-
-  if (!multi350::sendPatternDisplayLUT(patternSequence)) {
-    std::cerr << "[Controller] Failed to send pattern sequence to LUT"
-              << std::endl;
-    return false;
-  }
-
-  if (!Controller::validatePatternSequenceSingle()) {
-    return false;
-  }
-
-  return Controller::setPatternStatusSingle(PatternStatus::START);
+  return Controller::setPatternStatusSingle(device, PatternStatus::START);
 }
 
 bool Controller::startVarExpPatSequence(VarExpPatSequence &varExpPatSequence) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
   if (projectors.empty()) {
-    std::cout << "[Controller] No projectors connected" << std::endl;
+    logInfo() << "[Controller] No projectors connected";
     return true;
   }
 
+  // kept for replaying the sequence after a reconnect
+  auto sequence = std::make_shared<VarExpPatSequence>(varExpPatSequence);
+  bool result = true;
   for (auto &projector : projectors) {
-    if (projector.controlled) {
-      USB::select(projector.index);
-      if (!Controller::startVarExpPatSequenceSingle(varExpPatSequence)) {
-        std::cerr
-            << "[Controller] Failed to start variable exposure pattern sequence"
-            << std::endl;
-        return false;
+    if (projector.controlled && Controller::isAvailable(projector)) {
+      auto *device = USB::getDevice(projector.index);
+      if (!device)
+        continue;
+
+      if (!Controller::startVarExpPatSequenceSingle(*device,
+                                                    varExpPatSequence)) {
+        logError() << "[Controller] Failed to start variable exposure "
+                      "pattern sequence";
+        result = false;
+        continue;
       }
       projector.patternStatus = PatternStatus::START;
+      projector.varExpPatSequence = sequence;
+      projector.patternSequence.reset();
     }
   }
 
-  std::cout << "[Controller] Set display mode: Pattern" << std::endl;
-  return true;
+  logInfo() << "[Controller] Set display mode: Pattern";
+  return result;
 }
 
 bool Controller::startVarExpPatSequenceSingle(
-    VarExpPatSequence &varExpPatSequence) {
-  if (!Controller::setDisplayModeSingle(DisplayMode::PATTERN)) {
-    return false;
-  }
-
-  if (!multi350::setPatternDataSource(PatternDataSource::EXTERNAL)) {
-    std::cerr << "[Controller] Failed to set pattern data source" << std::endl;
+    USB::Device &device, VarExpPatSequence &varExpPatSequence) {
+  if (!Controller::setDisplayModeSingle(device, DisplayMode::PATTERN)) {
     return false;
   }
 
-  if (!multi350::setPatternTriggerMode(PatternTriggerMode::MODE4)) {
-    std::cerr << "[Controller] Failed to set pattern trigger mode" << std::endl;
+  bool changed = false;
+  if (!Controller::configureVarExpPatSequenceSingle(device, varExpPatSequence,
+                                                    changed)) {
     return false;
   }
 
-  if (!multi350::configureVarExpPatSequence(varExpPatSequence)) {
-    std::cerr
-        << "[Controller] Failed to configure variable exposure pattern sequence"
-        << std::endl;
+  if (changed && !Controller::validatePatternSequenceSingle(device)) {
     return false;
   }
 
-  if (!multi350::sendVarExpPatDisplayLUT(varExpPatSequence)) {
-    std::cerr << "[Controller] Failed to send variable exposure pattern "
-                 "sequence to LUT"
-              << std::endl;
-    return false;
-  }
-
-  if (!Controller::validatePatternSequenceSingle()) {
-    return false;
-  }
-
-  return Controller::setPatternStatusSingle(PatternStatus::START);
+  return Controller::setPatternStatusSingle(device, PatternStatus::START);
 }
 
 bool Controller::stopPatternSequence() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
   if (projectors.empty()) {
-    std::cout << "[Controller] No projectors connected" << std::endl;
+    logInfo() << "[Controller] No projectors connected";
     return true;
   }
 
+  bool result = true;
   for (auto &projector : projectors) {
-    if (projector.controlled) {
-      USB::select(projector.index);
-      if (!Controller::setPatternStatusSingle(PatternStatus::STOP)) {
-        std::cerr << "[Controller] Failed to stop pattern sequence"
-                  << std::endl;
-        return false;
+    if (projector.controlled && Controller::isAvailable(projector)) {
+      auto *device = USB::getDevice(projector.index);
+      if (!device)
+        continue;
+
+      if (!Controller::setPatternStatusSingle(*device, PatternStatus::STOP)) {
+        logError() << "[Controller] Failed to stop pattern sequence";
+        result = false;
+        continue;
       }
       projector.patternStatus = PatternStatus::STOP;
     }
   }
-  std::cout << "[Controller] Pattern Stopped" << std::endl;
+  logInfo() << "[Controller] Pattern Stopped";
+  return result;
+}
+
+// configuration written along with the LUT, recorded per device so an
+// unchanged one is neither written nor validated again
+static std::vector<uint8_t> getConfiguration(uint32_t kind, uint32_t num,
+                                             uint32_t exposure = 0,
+                                             uint32_t period = 0) {
+  uint32_t values[] = {kind, num, exposure, period};
+  auto *bytes = reinterpret_cast<const uint8_t *>(values);
+  return {bytes, bytes + sizeof(values)};
+}
+
+bool Controller::configurePatternSequenceSingle(
+    USB::Device &device, PatternSequence &patternSequence, bool &changed) {
+  auto configuration = getConfiguration(
+      0, static_cast<uint32_t>(patternSequence.getPatternNum()),
+      patternSequence.getExposure(), patternSequence.getPeriod());
+
+  Batch batch(device);
+  auto &record = device.getUploadRecord();
+  bool configured = record.validated && record.configuration == configuration;
+  if (!configured) {
+    batch.set<commands::PatternDataSource>(PatternDataSource::EXTERNAL);
+    multi350::configurePatternSequence(batch, patternSequence);
+    batch.set<commands::PatternTriggerMode>(PatternTriggerMode::MODE0);
+    multi350::setPatternPeriod(batch, patternSequence.getExposure(),
+                               patternSequence.getPeriod());
+  }
+  bool sent = multi350::sendPatternDisplayLUT(batch, patternSequence);
+
+  if (!batch.commit()) {
+    logError() << "[Controller] Failed to configure pattern sequence at "
+               << batch.getFailedName();
+    return false;
+  }
+
+  if (!configured)
+    record.configuration = std::move(configuration);
+  changed = !configured || sent;
+  return true;
+}
+
+bool Controller::configureVarExpPatSequenceSingle(
+    USB::Device &device, VarExpPatSequence &varExpPatSequence, bool &changed) {
+  auto configuration = getConfiguration(
+      1, static_cast<uint32_t>(varExpPatSequence.getVarExpPatNum()));
+
+  Batch batch(device);
+  auto &record = device.getUploadRecord();
+  bool configured = record.validated && record.configuration == configuration;
+  if (!configured) {
+    batch.set<commands::PatternDataSource>(PatternDataSource::EXTERNAL);
+    batch.set<commands::PatternTriggerMode>(PatternTriggerMode::MODE4);
+    multi350::configureVarExpPatSequence(batch, varExpPatSequence);
+  }
+  bool sent = multi350::sendVarExpPatDisplayLUT(batch, varExpPatSequence);
+
+  if (!batch.commit()) {
+    logError() << "[Controller] Failed to configure variable exposure pattern "
+                  "sequence at "
+               << batch.getFailedName();
+    return false;
+  }
+
+  if (!configured)
+    record.configuration = std::move(configuration);
+  changed = !configured || sent;
   return true;
 }
 
-bool Controller::validatePatternSequenceSingle() {
-  Controller::setPatternStatusSingle(PatternStatus::STOP);
+bool Controller::validatePatternSequenceSingle(USB::Device &device) {
+  Controller::setPatternStatusSingle(device, PatternStatus::STOP);
 
-  multi350::startPatternValidation();
+  multi350::startPatternValidation(device);
 
-  auto checkBusy = multi350::checkPatternValidation();
-  if (checkBusy->isReady()) {
-    std::cerr << "[Controller] Validation command not executed properly"
-              << std::endl;
+  auto checkBusy = multi350::checkPatternValidation(device);
+  if (!checkBusy || checkBusy->isReady()) {
+    logError() << "[Controller] Validation command not executed properly";
     return false;
   }
 
-  for (int i = 0; i < maxRetries; ++i) {
-    auto validation = multi350::checkPatternValidation();
-    if (validation->isReady()) {
+  for (int i = 0; i < maxRetries && device.isOpen(); ++i) {
+    auto validation = multi350::checkPatternValidation(device);
+    if (validation && validation->isReady()) {
       if (validation->isValid()) {
+        std::lock_guard<std::mutex> lock(device.getMutex());
+        device.getUploadRecord().validated = true;
         return true;
       } else {
-        std::cerr << "[Controller] Pattern failed to validate" << std::endl;
+        logError() << "[Controller] Pattern failed to validate";
         return false;
       }
     }
     std::this_thread::sleep_for(100ms);
   }
 
-  std::cerr << "[Controller] Exceed max retries on validate" << std::endl;
+  logError() << "[Controller] Exceed max retries on validate";
   return false;
 }
 
-bool Controller::setPatternStatusSingle(PatternStatus psStatus) {
+bool Controller::setPatternStatusSingle(USB::Device &device,
+                                        PatternStatus psStatus) {
 
-  multi350::setPatternStatus(psStatus);
+  multi350::setPatternStatus(device, psStatus);
 
-  for (int i = 0; i < maxRetries; ++i) {
+  for (int i = 0; i < maxRetries && device.isOpen(); ++i) {
     std::this_thread::sleep_for(100ms);
 
-    auto currentStatus = multi350::getPatternStatus();
-    if (*currentStatus == psStatus) {
+    auto currentStatus = multi350::getPatternStatus(device);
+    if (currentStatus && *currentStatus == psStatus) {
       return true;
     }
-    multi350::setPatternStatus(psStatus);
+    multi350::setPatternStatus(device, psStatus);
   }
 
-  std::cerr
-      << "[Controller] Exceeded max retries on Pattern Sequence start/stop"
-      << std::endl;
+  logError()
+      << "[Controller] Exceeded max retries on Pattern Sequence start/stop";
   return false;
 }
 
 bool Controller::setLEDCurrent(const std::vector<LEDCurrent> &currents) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
   if (currents.size() != projectors.size()) {
-    std::cerr << "[Controller] Number of controlled projectors doesn't match "
-                 "input argument."
-              << std::endl;
+    logError() << "[Controller] Number of controlled projectors doesn't match "
+                  "input argument.";
     return false;
   }
 
@@ -490,11 +849,12 @@ bool Controller::setLEDCurrent(const std::vector<LEDCurrent> &currents) {
     }
   }
 
-  std::cout << "[Controller] LED currents configured" << std::endl;
+  logInfo() << "[Controller] LED currents configured";
   return true;
 }
 
 bool Controller::setLEDCurrent(unsigned int index, LEDCurrent ledCurrent) {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
   assert(ledCurrent.red >= 0);
   assert(ledCurrent.red <= 255);
   assert(ledCurrent.green >= 0);
@@ -503,8 +863,7 @@ bool Controller::setLEDCurrent(unsigned int index, LEDCurrent ledCurrent) {
   assert(ledCurrent.blue <= 255);
 
   if (index >= projectors.size()) {
-    std::cerr << "[Controller] Index exceeds # of controlled projectors"
-              << std::endl;
+    logError() << "[Controller] Index exceeds # of controlled projectors";
     return false;
   }
 
@@ -512,9 +871,14 @@ bool Controller::setLEDCurrent(unsigned int index, LEDCurrent ledCurrent) {
     return true;
   }
 
-  USB::select(projectors[index].index);
+  if (!Controller::isAvailable(projectors[index]))
+    return false;
+
+  auto *device = USB::getDevice(projectors[index].index);
+  if (!device)
+    return false;
 
-  if (!multi350::setLEDCurrent(ledCurrent.red, ledCurrent.green,
+  if (!multi350::setLEDCurrent(*device, ledCurrent.red, ledCurrent.green,
                                ledCurrent.blue)) {
     return false;
   }
@@ -525,7 +889,306 @@ bool Controller::setLEDCurrent(unsigned int index, LEDCurrent ledCurrent) {
   return true;
 }
 
+Task<bool> Controller::setDisplayModeAsync(DisplayMode displayMode) {
+  std::unique_lock<std::recursive_mutex> lock(mutex);
+  if (projectors.empty()) {
+    logInfo() << "[Controller] No projectors connected";
+    co_return true;
+  }
+
+  std::vector<Task<bool>> tasks;
+  for (auto &projector : projectors) {
+    if (projector.controlled && Controller::isAvailable(projector)) {
+      tasks.push_back(
+          Controller::setDisplayModeSingleAsync(projector.index, displayMode));
+    }
+  }
+
+  lock.unlock();
+  if (!co_await whenAll(tasks)) {
+    logError() << "[Controller] Failed to set display mode";
+    co_return false;
+  }
+
+  co_return true;
+}
+
+Task<bool>
+Controller::startPatternSequenceAsync(PatternSequence &patternSequence) {
+  std::unique_lock<std::recursive_mutex> lock(mutex);
+  if (projectors.empty()) {
+    logInfo() << "[Controller] No projectors connected";
+    co_return true;
+  }
+
+  std::vector<Task<bool>> tasks;
+  for (auto &projector : projectors) {
+    if (projector.controlled && Controller::isAvailable(projector)) {
+      tasks.push_back(Controller::startPatternSequenceSingleAsync(
+          projector.index, patternSequence));
+    }
+  }
+
+  lock.unlock();
+  if (!co_await whenAll(tasks)) {
+    logError() << "[Controller] Failed to start pattern sequence";
+    co_return false;
+  }
+
+  logInfo() << "[Controller] Set display mode: Pattern";
+  co_return true;
+}
+
+Task<bool> Controller::startVarExpPatSequenceAsync(
+    VarExpPatSequence &varExpPatSequence) {
+  std::unique_lock<std::recursive_mutex> lock(mutex);
+  if (projectors.empty()) {
+    logInfo() << "[Controller] No projectors connected";
+    co_return true;
+  }
+
+  std::vector<Task<bool>> tasks;
+  for (auto &projector : projectors) {
+    if (projector.controlled && Controller::isAvailable(projector)) {
+      tasks.push_back(Controller::startVarExpPatSequenceSingleAsync(
+          projector.index, varExpPatSequence));
+    }
+  }
+
+  lock.unlock();
+  if (!co_await whenAll(tasks)) {
+    logError()
+        << "[Controller] Failed to start variable exposure pattern sequence";
+    co_return false;
+  }
+
+  logInfo() << "[Controller] Set display mode: Pattern";
+  co_return true;
+}
+
+Task<bool> Controller::stopPatternSequenceAsync() {
+  std::unique_lock<std::recursive_mutex> lock(mutex);
+  if (projectors.empty()) {
+    logInfo() << "[Controller] No projectors connected";
+    co_return true;
+  }
+
+  std::vector<Task<bool>> tasks;
+  std::vector<unsigned int> stopped;
+  for (auto &projector : projectors) {
+    if (projector.controlled && Controller::isAvailable(projector)) {
+      auto *device = USB::getDevice(projector.index);
+      if (!device)
+        co_return false;
+
+      tasks.push_back(Controller::setPatternStatusSingleAsync(
+          *device, PatternStatus::STOP));
+      stopped.push_back(projector.index);
+    }
+  }
+
+  lock.unlock();
+  bool result = co_await whenAll(tasks);
+  for (size_t i = 0; i < tasks.size(); ++i) {
+    if (tasks[i].getResult()) {
+      Controller::updateProjector(stopped[i], [](Projector &projector) {
+        projector.patternStatus = PatternStatus::STOP;
+      });
+    }
+  }
+
+  if (!result) {
+    logError() << "[Controller] Failed to stop pattern sequence";
+    co_return false;
+  }
+
+  logInfo() << "[Controller] Pattern Stopped";
+  co_return true;
+}
+
+Task<bool> Controller::setDisplayModeSingleAsync(unsigned int index,
+                                                 DisplayMode displayMode) {
+  auto *device = USB::getDevice(index);
+  if (!device)
+    co_return false;
+
+  auto currentDisplayMode = co_await multi350::getDisplayModeAsync(*device);
+  if (!currentDisplayMode)
+    co_return false;
+
+  // If device is already in pattern mode, stop sequence
+  if (*currentDisplayMode == DisplayMode::PATTERN) {
+    auto patternStatus = co_await multi350::getPatternStatusAsync(*device);
+    if (!patternStatus)
+      co_return false;
+
+    if (*patternStatus != PatternStatus::STOP) {
+      if (!co_await Controller::setPatternStatusSingleAsync(
+              *device, PatternStatus::STOP)) {
+        co_return false;
+      }
+      Controller::updateProjector(index, [](Projector &projector) {
+        projector.patternStatus = PatternStatus::STOP;
+      });
+    }
+  }
+
+  auto apply = [displayMode](Projector &projector) {
+    projector.displayMode = displayMode;
+  };
+
+  if (*currentDisplayMode == displayMode) {
+    Controller::updateProjector(index, apply);
+    co_return true;
+  }
+
+  co_await multi350::setDisplayModeAsync(*device, displayMode);
+
+  for (int i = 0; i < maxRetries && device->isOpen(); ++i) {
+    co_await sleepFor(100ms);
+
+    auto newDisplayMode = co_await multi350::getDisplayModeAsync(*device);
+    if (newDisplayMode && *newDisplayMode == displayMode) {
+      Controller::updateProjector(index, apply);
+      co_return true;
+    }
+  }
+
+  logError() << "[Controller] Exceeded max retries on display mode change";
+  co_return false;
+}
+
+Task<bool>
+Controller::startPatternSequenceSingleAsync(unsigned int index,
+                                            PatternSequence &patternSequence) {
+  auto *device = USB::getDevice(index);
+  if (!device)
+    co_return false;
+
+  if (!co_await Controller::setDisplayModeSingleAsync(index,
+                                                      DisplayMode::PATTERN)) {
+    co_return false;
+  }
+
+  bool changed = false;
+  if (!co_await call(*device, [this, device, &patternSequence, &changed] {
+        return configurePatternSequenceSingle(*device, patternSequence,
+                                              changed);
+      })) {
+    co_return false;
+  }
+
+  if (changed &&
+      !co_await Controller::validatePatternSequenceSingleAsync(*device)) {
+    co_return false;
+  }
+
+  if (!co_await Controller::setPatternStatusSingleAsync(*device,
+                                                        PatternStatus::START)) {
+    co_return false;
+  }
+
+  auto sequence = std::make_shared<PatternSequence>(patternSequence);
+  Controller::updateProjector(index, [&sequence](Projector &projector) {
+    projector.patternStatus = PatternStatus::START;
+    projector.patternSequence = sequence;
+    projector.varExpPatSequence.reset();
+  });
+  co_return true;
+}
+
+Task<bool> Controller::startVarExpPatSequenceSingleAsync(
+    unsigned int index, VarExpPatSequence &varExpPatSequence) {
+  auto *device = USB::getDevice(index);
+  if (!device)
+    co_return false;
+
+  if (!co_await Controller::setDisplayModeSingleAsync(index,
+                                                      DisplayMode::PATTERN)) {
+    co_return false;
+  }
+
+  bool changed = false;
+  if (!co_await call(*device, [this, device, &varExpPatSequence, &changed] {
+        return configureVarExpPatSequenceSingle(*device, varExpPatSequence,
+                                                changed);
+      })) {
+    co_return false;
+  }
+
+  if (changed &&
+      !co_await Controller::validatePatternSequenceSingleAsync(*device)) {
+    co_return false;
+  }
+
+  if (!co_await Controller::setPatternStatusSingleAsync(*device,
+                                                        PatternStatus::START)) {
+    co_return false;
+  }
+
+  auto sequence = std::make_shared<VarExpPatSequence>(varExpPatSequence);
+  Controller::updateProjector(index, [&sequence](Projector &projector) {
+    projector.patternStatus = PatternStatus::START;
+    projector.varExpPatSequence = sequence;
+    projector.patternSequence.reset();
+  });
+  co_return true;
+}
+
+Task<bool> Controller::validatePatternSequenceSingleAsync(USB::Device &device) {
+  co_await Controller::setPatternStatusSingleAsync(device,
+                                                   PatternStatus::STOP);
+
+  co_await startPatternValidationAsync(device);
+
+  auto checkBusy = co_await checkPatternValidationAsync(device);
+  if (!checkBusy || checkBusy->isReady()) {
+    logError() << "[Controller] Validation command not executed properly";
+    co_return false;
+  }
+
+  for (int i = 0; i < maxRetries && device.isOpen(); ++i) {
+    auto validation = co_await checkPatternValidationAsync(device);
+    if (validation && validation->isReady()) {
+      if (validation->isValid()) {
+        {
+          std::lock_guard<std::mutex> lock(device.getMutex());
+          device.getUploadRecord().validated = true;
+        }
+        co_return true;
+      } else {
+        logError() << "[Controller] Pattern failed to validate";
+        co_return false;
+      }
+    }
+    co_await sleepFor(100ms);
+  }
+
+  logError() << "[Controller] Exceed max retries on validate";
+  co_return false;
+}
+
+Task<bool> Controller::setPatternStatusSingleAsync(USB::Device &device,
+                                                   PatternStatus psStatus) {
+  co_await multi350::setPatternStatusAsync(device, psStatus);
+
+  for (int i = 0; i < maxRetries && device.isOpen(); ++i) {
+    co_await sleepFor(100ms);
+
+    auto currentStatus = co_await getPatternStatusAsync(device);
+    if (currentStatus && *currentStatus == psStatus) {
+      co_return true;
+    }
+    co_await multi350::setPatternStatusAsync(device, psStatus);
+  }
+
+  logError()
+      << "[Controller] Exceeded max retries on Pattern Sequence start/stop";
+  co_return false;
+}
+
 void Controller::printStatus() {
+  std::lock_guard<std::recursive_mutex> lock(mutex);
   for (auto &projector : projectors) {
     std::cout << "[Projector " << projector.index << "]" << std::endl;
     std::cout << " controlled: " << projector.controlled << std::endl;
@@ -0,0 +1,48 @@
+#include "multi350/coroutine.hpp"
+#include <cassert>
+
+namespace multi350 {
+
+thread_local Scheduler *Scheduler::active = nullptr;
+
+void Scheduler::schedule(std::coroutine_handle<> handle) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    ready.push_back(handle);
+  }
+  condition.notify_one();
+}
+
+void Scheduler::scheduleAt(Clock::time_point time,
+                           std::coroutine_handle<> handle) {
+  std::lock_guard<std::mutex> lock(mutex);
+  timers.emplace(time, handle);
+}
+
+Scheduler &Scheduler::current() {
+  assert(active && "no scheduler running on this thread");
+  return *active;
+}
+
+void Scheduler::step() {
+  std::coroutine_handle<> handle;
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (ready.empty()) {
+      if (!timers.empty() && timers.begin()->first <= Clock::now()) {
+        ready.push_back(timers.begin()->second);
+        timers.erase(timers.begin());
+      } else if (!timers.empty()) {
+        condition.wait_until(lock, timers.begin()->first);
+      } else {
+        condition.wait(lock);
+      }
+    }
+
+    handle = ready.front();
+    ready.pop_front();
+  }
+
+  handle.resume();
+}
+}; // namespace multi350
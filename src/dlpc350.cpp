@@ -1,59 +1,237 @@
 #include "multi350/dlpc350.hpp"
+#include "multi350/commands.hpp"
+#include "multi350/log.hpp"
 #include "multi350/message.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <vector>
 
 namespace multi350 {
+// the pointer returning getters wrap the value returning ones
+template <typename T> static std::unique_ptr<T> toUnique(Result<T> &&result) {
+  if (!result)
+    return nullptr;
+  return std::make_unique<T>(std::move(*result));
+}
+
+// writes to the sequence configuration leave it to be validated again
+static void invalidate(USB::UploadRecord &record) {
+  record.configuration.clear();
+  record.validated = false;
+}
+
+static void invalidate(USB::Device &device) {
+  std::lock_guard<std::mutex> lock(device.getMutex());
+  invalidate(device.getUploadRecord());
+}
+
+namespace {
+// entries [first, last) of a LUT written from one mailbox offset
+struct Range {
+  size_t first;
+  size_t last;
+};
+} // namespace
+
+// Ranges of the entries that differ from the record of the last upload, each
+// fitting a single message. Unchanged entries between two ranges are sent
+// along while they take less than a report, which a new offset would cost.
+template <typename C, typename Entry>
+static std::vector<Range> findChanged(const std::vector<uint8_t> &record,
+                                      size_t count, Entry &&entry) {
+  constexpr size_t size = C::entrySize;
+  constexpr size_t maxCount = C::paramSize / size;
+  constexpr size_t maxGap = USB::packetSize / size;
+
+  std::vector<Range> ranges;
+  for (size_t i = 0; i < count; i++) {
+    if ((i + 1) * size <= record.size() &&
+        memcmp(&record[i * size], entry(i), size) == 0)
+      continue;
+
+    if (!ranges.empty() && i - ranges.back().last <= maxGap &&
+        i + 1 - ranges.back().first <= maxCount) {
+      ranges.back().last = i + 1;
+    } else {
+      ranges.push_back({i, i + 1});
+    }
+  }
+  return ranges;
+}
+
+template <typename C, typename Entry>
+static void updateRecord(std::vector<uint8_t> &record, size_t count,
+                         Entry &&entry) {
+  // entries past the end of a shorter sequence stay in the device
+  record.resize(std::max(record.size(), count * C::entrySize));
+  for (size_t i = 0; i < count; i++) {
+    memcpy(&record[i * C::entrySize], entry(i), C::entrySize);
+  }
+}
+
 /**
  * getHardwareStatus
  * CMD2 : 0x1A, CMD3 : 0x0A
  */
-std::unique_ptr<HardwareStatus> getHardwareStatus() {
-  auto result = sendGetMessage<HardwareStatus>(0x1A0A);
-  return std::make_unique<HardwareStatus>(*result.get());
+std::unique_ptr<HardwareStatus> getHardwareStatus(USB::Device &device) {
+  return toUnique(readHardwareStatus(device));
+}
+
+Result<HardwareStatus> readHardwareStatus(USB::Device &device) {
+  return readCommand<commands::HardwareStatus>(device);
+}
+
+bool getHardwareStatus(USB::Device &device, HardwareStatus &status) {
+  return getCommand<commands::HardwareStatus>(device, status);
 }
 
 /**
  * getSystemStatus
  * CMD2 : 0x1A, CMD3 : 0x0B
  */
-std::unique_ptr<SystemStatus> getSystemStatus() {
-  auto result = sendGetMessage<SystemStatus>(0x1A0B);
-  return std::make_unique<SystemStatus>(*result.get());
+std::unique_ptr<SystemStatus> getSystemStatus(USB::Device &device) {
+  return toUnique(readSystemStatus(device));
+}
+
+Result<SystemStatus> readSystemStatus(USB::Device &device) {
+  return readCommand<commands::SystemStatus>(device);
+}
+
+bool getSystemStatus(USB::Device &device, SystemStatus &status) {
+  return getCommand<commands::SystemStatus>(device, status);
 }
 
 /**
  * getMainStatus
  * CMD2 : 0x1A, CMD3 : 0x0C
  */
-std::unique_ptr<MainStatus> getMainStatus() {
-  auto result = sendGetMessage<MainStatus>(0x1A0C);
-  return std::make_unique<MainStatus>(*result.get());
+std::unique_ptr<MainStatus> getMainStatus(USB::Device &device) {
+  return toUnique(readMainStatus(device));
+}
+
+Result<MainStatus> readMainStatus(USB::Device &device) {
+  return readCommand<commands::MainStatus>(device);
+}
+
+bool getMainStatus(USB::Device &device, MainStatus &status) {
+  return getCommand<commands::MainStatus>(device, status);
+}
+
+/**
+ * getStatus
+ * Hardware, system and main status pipelined in a single round trip
+ */
+bool getStatus(USB::Device &device, HardwareStatus &hardwareStatus,
+               SystemStatus &systemStatus, MainStatus &mainStatus) {
+  auto status = readStatus(device);
+  if (!status)
+    return false;
+
+  hardwareStatus = status->hardware;
+  systemStatus = status->system;
+  mainStatus = status->main;
+  return true;
+}
+
+Result<StatusRegisters> readStatus(USB::Device &device) {
+  StatusRegisters status;
+  Pipeline pipeline(device);
+  auto hardware = pipeline.postGet(commands::HardwareStatus::opcode);
+  auto system = pipeline.postGet(commands::SystemStatus::opcode);
+  auto main = pipeline.postGet(commands::MainStatus::opcode);
+
+  bool result = pipeline.wait(hardware, status.hardware);
+  result = pipeline.wait(system, status.system) && result;
+  result = pipeline.wait(main, status.main) && result;
+  // told while the pipeline still holds the device lock
+  if (!result)
+    return std::unexpected(getError(device));
+  return status;
+}
+
+/**
+ * readSnapshot
+ * Power mode, LED current, display mode, pattern status and the status
+ * registers pipelined in a single round trip
+ */
+Result<Snapshot> readSnapshot(USB::Device &device) {
+  auto start = std::chrono::steady_clock::now();
+  Snapshot snapshot{};
+  {
+    Pipeline pipeline(device);
+    auto powerMode = pipeline.postGet(commands::PowerMode::opcode);
+    auto ledCurrent = pipeline.postGet(commands::LEDCurrent::opcode);
+    auto displayMode = pipeline.postGet(commands::DisplayMode::opcode);
+    auto patternStatus = pipeline.postGet(commands::PatternStatus::opcode);
+    auto hardware = pipeline.postGet(commands::HardwareStatus::opcode);
+    auto system = pipeline.postGet(commands::SystemStatus::opcode);
+    auto main = pipeline.postGet(commands::MainStatus::opcode);
+
+    bool result = pipeline.wait(powerMode, snapshot.powerMode);
+    result = pipeline.wait(ledCurrent, snapshot.ledCurrent) && result;
+    result = pipeline.wait(displayMode, snapshot.displayMode) && result;
+    result = pipeline.wait(patternStatus, snapshot.patternStatus) && result;
+    result = pipeline.wait(hardware, snapshot.hardwareStatus) && result;
+    result = pipeline.wait(system, snapshot.systemStatus) && result;
+    result = pipeline.wait(main, snapshot.mainStatus) && result;
+    // told while the pipeline still holds the device lock
+    if (!result)
+      return std::unexpected(getError(device));
+  }
+
+  // stored as 255 - current, like setLEDCurrent sends it
+  auto &current = snapshot.ledCurrent;
+  current = LEDCurrent(255 - current.red, 255 - current.green,
+                       255 - current.blue);
+  snapshot.latency = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start);
+  return snapshot;
 }
 
 /**
  * getVersion
  * CMD2 : 0x02, CMD3 : 0x05
  */
-std::unique_ptr<Version> getVersion() {
-  auto result = sendGetMessage<uint32_t>(0x0205);
-  return std::make_unique<Version>(*(result.get()), *(result.get() + 1),
-                                   *(result.get() + 2), *(result.get() + 3));
+std::unique_ptr<Version> getVersion(USB::Device &device) {
+  return toUnique(readVersion(device));
+}
+
+Result<Version> readVersion(USB::Device &device) {
+  auto value = readCommand<commands::Version>(device);
+  if (!value)
+    return std::unexpected(value.error());
+  return Version((*value)[0], (*value)[1], (*value)[2], (*value)[3]);
 }
 
 /**
  * getFirmwareTag
  * CMD2 : 0x1A, CMD3 : 0xFF
  */
-std::unique_ptr<std::string> getFirmwareTag() {
-  auto result = sendGetMessage<char>(0x1AFF);
-  return std::make_unique<std::string>(result.get());
+std::unique_ptr<std::string> getFirmwareTag(USB::Device &device) {
+  return toUnique(readFirmwareTag(device));
+}
+
+Result<std::string> readFirmwareTag(USB::Device &device) {
+  auto value = readCommand<commands::FirmwareTag>(device);
+  if (!value)
+    return std::unexpected(value.error());
+  // not terminated if the tag takes all 32 characters
+  return std::string(value->data(), strnlen(value->data(), value->size()));
 }
 
 /**
  * softwareReset
  * CMD2 : 0x08, CMD3 : 0x02
  */
-bool softwareReset() {
-  auto result = sendNoAckMessage(0x0802);
+bool softwareReset(USB::Device &device) {
+  {
+    std::lock_guard<std::mutex> lock(device.getMutex());
+    device.getUploadRecord().clear();
+  }
+  auto result = sendNoAckMessage(device, commands::SoftwareReset::opcode);
   return (result > 0);
 }
 
@@ -61,372 +239,549 @@ bool softwareReset() {
  * getPowerMode
  * CMD2 : 0x02, CMD3 : 0x00
  */
-std::unique_ptr<PowerMode> getPowerMode() {
-  auto result = sendGetMessage<PowerMode>(0x0200);
-  return std::make_unique<PowerMode>(*result.get());
+std::unique_ptr<PowerMode> getPowerMode(USB::Device &device) {
+  return toUnique(readPowerMode(device));
+}
+
+Result<PowerMode> readPowerMode(USB::Device &device) {
+  return readCommand<commands::PowerMode>(device);
 }
 
 /**
  * setPowerMode
  * CMD2 : 0x02, CMD3 : 0x00, Param : 1
  */
-bool setPowerMode(PowerMode mode) {
-  auto result = sendSetMessage<uint8_t>(0x0200, static_cast<uint8_t>(mode));
-  return (result != nullptr);
+bool setPowerMode(USB::Device &device, PowerMode mode) {
+  return setCommand<commands::PowerMode>(device, mode);
 }
 
 /**
  * getColorCurtain
  * CMD2 : 0x11, CMD3 : 0x00
  */
-std::unique_ptr<CurtainColor> getColorCurtain() {
-  auto result = sendGetMessage<uint16_t>(0x1100);
-  return std::make_unique<CurtainColor>(*result.get(), *(result.get() + 1),
-                                        *(result.get() + 2));
+std::unique_ptr<CurtainColor> getColorCurtain(USB::Device &device) {
+  return toUnique(readColorCurtain(device));
+}
+
+Result<CurtainColor> readColorCurtain(USB::Device &device) {
+  auto value = readCommand<commands::ColorCurtain>(device);
+  if (!value)
+    return std::unexpected(value.error());
+  return CurtainColor((*value)[0], (*value)[1], (*value)[2]);
 }
 
 /**
  * setColorCurtain
  * CMD2 : 0x11, CMD3 : 0x00, Param : 6
  */
-bool setColorCurtain(uint16_t red, uint16_t green, uint16_t blue) {
-  auto result = sendSetMessage<uint16_t, uint16_t, uint16_t>(
-      0x1100, std::forward<uint16_t>(red), std::forward<uint16_t>(green),
-      std::forward<uint16_t>(blue));
-  return (result != nullptr);
+bool setColorCurtain(USB::Device &device, uint16_t red, uint16_t green,
+                     uint16_t blue) {
+  return setCommand<commands::ColorCurtain>(device, red, green, blue);
 }
 
 /**
  * getInputSource
  * CMD2 : 0x1A, CMD3 : 0x00
  */
-std::unique_ptr<InputSource> getInputSource() {
-  auto result = sendGetMessage<InputSource>(0x1A00);
-  return std::make_unique<InputSource>(*result.get());
+std::unique_ptr<InputSource> getInputSource(USB::Device &device) {
+  return toUnique(readInputSource(device));
+}
+
+// the input source is recorded, so the test pattern commands can check it
+// without a read
+static void recordInputSource(USB::Device &device,
+                              std::optional<uint8_t> inputSource) {
+  std::lock_guard<std::mutex> lock(device.getMutex());
+  device.getUploadRecord().inputSource = inputSource;
+}
+
+Result<InputSource> readInputSource(USB::Device &device) {
+  auto inputSource = readCommand<commands::InputSource>(device);
+  if (inputSource)
+    recordInputSource(device, inputSource->value);
+  return inputSource;
 }
 
 /**
  * setInputSource
  * CMD2 : 0x1A, CMD3 : 0x00, Param : 1
  */
-bool setInputSource(InputType type, InputBitDepth bitDepth) {
-  auto result =
-      sendSetMessage<uint8_t>(0x1A00, InputSource(type, bitDepth).value);
-  return (result != nullptr);
+bool setInputSource(USB::Device &device, InputType type,
+                    InputBitDepth bitDepth) {
+  InputSource inputSource(type, bitDepth);
+  if (!setCommand<commands::InputSource>(device, inputSource.value)) {
+    recordInputSource(device, std::nullopt);
+    return false;
+  }
+  recordInputSource(device, inputSource.value);
+  return true;
+}
+
+// checked against the recorded input source, an unknown one passes
+static bool isShowingTestPattern(USB::Device &device) {
+  std::lock_guard<std::mutex> lock(device.getMutex());
+  auto &inputSource = device.getUploadRecord().inputSource;
+  if (!inputSource ||
+      InputSource(*inputSource).type == InputType::TEST_PATTERN)
+    return true;
+
+  logError() << "[DLPC350] Input source is not the test pattern generator: "
+             << device.getPath();
+  return false;
 }
 
 /**
  * getTestPattern
  * CMD2 : 0x12, CMD3 : 0x03
+ * Fails without a read if the input source last set or read is not the test
+ * pattern generator.
  */
-std::unique_ptr<TestPattern> getTestPattern() {
-  assert(getInputSource()->type == InputType::TEST_PATTERN);
-  auto result = sendGetMessage<TestPattern>(0x1203);
-  return std::make_unique<TestPattern>(*result.get());
+std::unique_ptr<TestPattern> getTestPattern(USB::Device &device) {
+  return toUnique(readTestPattern(device));
+}
+
+Result<TestPattern> readTestPattern(USB::Device &device) {
+  if (!isShowingTestPattern(device))
+    return std::unexpected(Error::DEVICE_ERROR);
+  return readCommand<commands::TestPattern>(device);
 }
 
 /**
  * setTestPattern
  * CMD2 : 0x12, CMD3 : 0x03, Param : 1
+ * Fails without a write if the input source last set or read is not the test
+ * pattern generator.
  */
-bool setTestPattern(TestPattern pattern) {
-  assert(getInputSource()->type == InputType::TEST_PATTERN);
-  auto result = sendSetMessage<uint8_t>(0x1203, static_cast<uint8_t>(pattern));
-  return (result != nullptr);
+bool setTestPattern(USB::Device &device, TestPattern pattern) {
+  if (!isShowingTestPattern(device))
+    return false;
+  return setCommand<commands::TestPattern>(device, pattern);
 }
 
 /**
  * getLEDEnable
  * CMD2 : 0x1A, CMD3 : 0x07
  */
-std::unique_ptr<LEDEnable> getLEDEnable() {
-  auto result = sendGetMessage<LEDEnable>(0x1A07);
-  return std::make_unique<LEDEnable>(*result.get());
+std::unique_ptr<LEDEnable> getLEDEnable(USB::Device &device) {
+  return toUnique(readLEDEnable(device));
+}
+
+Result<LEDEnable> readLEDEnable(USB::Device &device) {
+  return readCommand<commands::LEDEnable>(device);
 }
 
 /**
  * setLEDEnable
  * CMD2 : 0x1A, CMD3 : 0x07, Param : 1
  */
-bool setLEDEnable(LEDEnableMode mode, bool redEnabled, bool greenEnabled,
-                  bool blueEnabled) {
-  auto result = sendSetMessage<uint8_t>(
-      0x1A07, LEDEnable(mode, redEnabled, greenEnabled, blueEnabled).value);
-  return (result != nullptr);
+bool setLEDEnable(USB::Device &device, LEDEnableMode mode, bool redEnabled,
+                  bool greenEnabled, bool blueEnabled) {
+  return setCommand<commands::LEDEnable>(
+      device, LEDEnable(mode, redEnabled, greenEnabled, blueEnabled).value);
 }
 
 /**
  * getLEDCurrent
  * CMD2 : 0x0B, CMD3 : 0x01
  */
-std::unique_ptr<LEDCurrent> getLEDCurrent() {
-  auto result = sendGetMessage<uint32_t>(0x0B01);
-  return std::make_unique<LEDCurrent>(*result.get());
+std::unique_ptr<LEDCurrent> getLEDCurrent(USB::Device &device) {
+  return toUnique(readLEDCurrent(device));
+}
+
+Result<LEDCurrent> readLEDCurrent(USB::Device &device) {
+  auto value = readCommand<commands::LEDCurrent>(device);
+  if (!value)
+    return std::unexpected(value.error());
+  // stored as 255 - current, like setLEDCurrent sends it
+  return LEDCurrent(255 - value->red, 255 - value->green, 255 - value->blue);
 }
 
 /**
  * setLEDCurrent
  * CMD2 : 0x0B, CMD3 : 0x01, Param : 3
  */
-bool setLEDCurrent(uint8_t red, uint8_t green, uint8_t blue) {
-  auto result = sendSetMessage<uint8_t, uint8_t, uint8_t>(
-      0x0B01, 255 - red, 255 - green, 255 - blue);
-  return (result != nullptr);
+bool setLEDCurrent(USB::Device &device, uint8_t red, uint8_t green,
+                   uint8_t blue) {
+  return setCommand<commands::LEDCurrent>(device, 255 - red, 255 - green,
+                                         255 - blue);
 }
 
 /**
  * getDisplayMode
  * CMD2 : 0x1A, CMD3 : 0x1B
  */
-std::unique_ptr<DisplayMode> getDisplayMode() {
-  auto result = sendGetMessage<DisplayMode>(0x1A1B);
-  return std::make_unique<DisplayMode>(*result.get());
+std::unique_ptr<DisplayMode> getDisplayMode(USB::Device &device) {
+  return toUnique(readDisplayMode(device));
+}
+
+Result<DisplayMode> readDisplayMode(USB::Device &device) {
+  return readCommand<commands::DisplayMode>(device);
 }
 
 /**
  * setDisplayMode
  * CMD2 : 0x1A, CMD3 : 0x1B, Param : 1
  */
-bool setDisplayMode(DisplayMode mode) {
-  auto result = sendSetMessage<uint8_t>(0x1A1B, static_cast<uint8_t>(mode));
-  return (result != nullptr);
+bool setDisplayMode(USB::Device &device, DisplayMode mode) {
+  invalidate(device);
+  return setCommand<commands::DisplayMode>(device, mode);
 }
 
 /**
  * getGammaCorrection
  * CMD2 : 0x1A, CMD3 : 0x0E
  */
-std::unique_ptr<GammaCorrection> getGammaCorrection() {
-  auto result = sendGetMessage<GammaCorrection>(0x1A0E);
-  return std::make_unique<GammaCorrection>(*result.get());
+std::unique_ptr<GammaCorrection> getGammaCorrection(USB::Device &device) {
+  return toUnique(readGammaCorrection(device));
+}
+
+Result<GammaCorrection> readGammaCorrection(USB::Device &device) {
+  return readCommand<commands::GammaCorrection>(device);
 }
 
 /**
  * setGammaCorrection
  * CMD2 : 0x1A, CMD3 : 0x0E, Param : 1
  */
-bool setGammaCorrection(bool enable, bool degammaTable) {
-  auto result = sendSetMessage<uint8_t>(
-      0x1A0E, GammaCorrection(degammaTable, enable).value);
-  return (result != nullptr);
+bool setGammaCorrection(USB::Device &device, bool enable, bool degammaTable) {
+  return setCommand<commands::GammaCorrection>(
+      device, GammaCorrection(degammaTable, enable).value);
 }
 
 /**
  * startPatternValidation
  * CMD2 : 0x1A, CMD3 : 0x1A, Param : 1 // dummy byte
  */
-std::unique_ptr<PatternSequenceValidation> startPatternValidation() {
-  auto result = sendSetMessage<PatternSequenceValidation>(0x1A1A, 0x00);
-  return std::make_unique<PatternSequenceValidation>(*result.get());
+std::unique_ptr<PatternSequenceValidation>
+startPatternValidation(USB::Device &device) {
+  PatternSequenceValidation value;
+  auto send = makeSetMessage<commands::PatternValidation>(0x00);
+  if (!transact(device, send, value))
+    return nullptr;
+  return std::make_unique<PatternSequenceValidation>(value);
 }
 
 /**
  * checkPatternValidation
  * CMD2 : 0x1A, CMD3 : 0x1A
  */
-std::unique_ptr<PatternSequenceValidation> checkPatternValidation() {
-  auto result = sendGetMessage<PatternSequenceValidation>(0x1A1A);
-  return std::make_unique<PatternSequenceValidation>(*result.get());
+std::unique_ptr<PatternSequenceValidation>
+checkPatternValidation(USB::Device &device) {
+  return toUnique(readPatternValidation(device));
+}
+
+Result<PatternSequenceValidation> readPatternValidation(USB::Device &device) {
+  return readCommand<commands::PatternValidation>(device);
 }
 
 /**
  * getPatternTriggerMode
  * CMD2 : 0x1A, CMD3 : 0x23
  */
-std::unique_ptr<PatternTriggerMode> getPatternTriggerMode() {
-  auto result = sendGetMessage<PatternTriggerMode>(0x1A23);
-  return std::make_unique<PatternTriggerMode>(*result.get());
+std::unique_ptr<PatternTriggerMode> getPatternTriggerMode(USB::Device &device) {
+  return toUnique(readPatternTriggerMode(device));
+}
+
+Result<PatternTriggerMode> readPatternTriggerMode(USB::Device &device) {
+  return readCommand<commands::PatternTriggerMode>(device);
 }
 
 /**
  * setPatternTriggerMode
  * CMD2 : 0x1A, CMD3 : 0x23, Param : 1
  */
-bool setPatternTriggerMode(PatternTriggerMode mode) {
-  auto result = sendSetMessage<uint8_t>(0x1A23, static_cast<uint8_t>(mode));
-  return (result != nullptr);
+bool setPatternTriggerMode(USB::Device &device, PatternTriggerMode mode) {
+  invalidate(device);
+  return setCommand<commands::PatternTriggerMode>(device, mode);
 }
 
 /**
  * getPatternDataSource
  * CMD2 : 0x1A, CMD3 : 0x22
  */
-std::unique_ptr<PatternDataSource> getPatternDataSource() {
-  auto result = sendGetMessage<PatternDataSource>(0x1A22);
-  return std::make_unique<PatternDataSource>(*result.get());
+std::unique_ptr<PatternDataSource> getPatternDataSource(USB::Device &device) {
+  return toUnique(readPatternDataSource(device));
+}
+
+Result<PatternDataSource> readPatternDataSource(USB::Device &device) {
+  return readCommand<commands::PatternDataSource>(device);
 }
 
 /**
  * setPatternDataSource
  * CMD2 : 0x1A, CMD3 : 0x22, Param : 1
  */
-bool setPatternDataSource(PatternDataSource input) {
-  auto result = sendSetMessage<uint8_t>(0x1A22, static_cast<uint8_t>(input));
-  return (result != nullptr);
+bool setPatternDataSource(USB::Device &device, PatternDataSource input) {
+  invalidate(device);
+  return setCommand<commands::PatternDataSource>(device, input);
 }
 
 /**
  * getPatternStatus
  * CMD2 : 0x1A, CMD3 : 0x24
  */
-std::unique_ptr<PatternStatus> getPatternStatus() {
-  auto result = sendGetMessage<PatternStatus>(0x1A24);
-  return std::make_unique<PatternStatus>(*result.get());
+std::unique_ptr<PatternStatus> getPatternStatus(USB::Device &device) {
+  return toUnique(readPatternStatus(device));
+}
+
+Result<PatternStatus> readPatternStatus(USB::Device &device) {
+  return readCommand<commands::PatternStatus>(device);
 }
 
 /**
  * setPatternStatus
  * CMD2 : 0x1A, CMD3 : 0x24, Param : 1
  */
-bool setPatternStatus(PatternStatus mode) {
-  auto result = sendSetMessage<uint8_t>(0x1A24, static_cast<uint8_t>(mode));
-  return (result != nullptr);
+bool setPatternStatus(USB::Device &device, PatternStatus mode) {
+  return setCommand<commands::PatternStatus>(device, mode);
 }
 
 /**
  * getPatternPeriod
  * CMD2 : 0x1A, CMD3 : 0x29
  */
-std::unique_ptr<PatternPeriod> getPatternPeriod() {
-  auto result = sendGetMessage<uint32_t>(0x1A29);
-  return std::make_unique<PatternPeriod>(*result.get(), *(result.get() + 1));
+std::unique_ptr<PatternPeriod> getPatternPeriod(USB::Device &device) {
+  return toUnique(readPatternPeriod(device));
+}
+
+Result<PatternPeriod> readPatternPeriod(USB::Device &device) {
+  return readCommand<commands::PatternPeriod>(device);
 }
 
 /**
  * setPatternPeriod
  * CMD2 : 0x1A, CMD3 : 0x29, Param : 8
  */
-bool setPatternPeriod(uint32_t exposure, uint32_t frame) {
+bool setPatternPeriod(USB::Device &device, uint32_t exposure, uint32_t frame) {
   assert(exposure <= frame);
   assert(frame - exposure > 230);
 
-  auto result = sendSetMessage<uint32_t, uint32_t>(
-      0x1A29, std::forward<uint32_t>(exposure), std::forward<uint32_t>(frame));
-  return (result != nullptr);
+  invalidate(device);
+  return setCommand<commands::PatternPeriod>(device, exposure, frame);
+}
+
+void setPatternPeriod(Batch &batch, uint32_t exposure, uint32_t frame) {
+  assert(exposure <= frame);
+  assert(frame - exposure > 230);
+
+  invalidate(batch.getDevice().getUploadRecord());
+  batch.set<commands::PatternPeriod>(exposure, frame);
 }
 
 /**
  * setMailboxMode
  * CMD2 : 0x1A, CMD3 : 0x33, Param : 1
  */
-bool setMailboxMode(MailboxMode mode) {
-  auto result = sendSetMessage<uint8_t>(0x1A33, static_cast<uint8_t>(mode));
-  return (result != nullptr);
+bool setMailboxMode(USB::Device &device, MailboxMode mode) {
+  return setCommand<commands::MailboxMode>(device, mode);
 }
 
 /**
  * setMailboxOffset
  * CMD2 : 0x1A, CMD3 : 0x32, Param : 1
  */
-bool setMailboxOffset(uint8_t offset) {
+bool setMailboxOffset(USB::Device &device, uint8_t offset) {
   assert(offset <= 127);
 
-  auto result = sendSetMessage<uint8_t>(0x1A32, std::forward<uint8_t>(offset));
-  return (result != nullptr);
+  return setCommand<commands::MailboxOffset>(device, offset);
 }
 
 /**
  * setMailboxVarExpOffset
  * CMD2 : 0x1A, CMD3 : 0x3F, Param : 2
  */
-bool setMailboxVarExpOffset(uint16_t offset) {
+bool setMailboxVarExpOffset(USB::Device &device, uint16_t offset) {
   assert(offset <= 1823);
 
-  auto result =
-      sendSetMessage<uint16_t>(0x1A3F, std::forward<uint16_t>(offset));
-  return (result != nullptr);
+  return setCommand<commands::MailboxVarExpOffset>(device, offset);
 }
 
 /**
  * configurePatternSequence
  * CMD2 : 0x1A, CMD3 : 0x31, Param : 4
  */
-bool configurePatternSequence(PatternSequence &patternSequence, bool repeat,
+bool configurePatternSequence(USB::Device &device,
+                              PatternSequence &patternSequence, bool repeat,
                               uint8_t patternNumPerTrigOut2) {
+  Batch batch(device);
+  configurePatternSequence(batch, patternSequence, repeat,
+                           patternNumPerTrigOut2);
+  return batch.commit();
+}
+
+void configurePatternSequence(Batch &batch, PatternSequence &patternSequence,
+                              bool repeat, uint8_t patternNumPerTrigOut2) {
   if (repeat) {
     patternNumPerTrigOut2 =
         static_cast<uint8_t>(patternSequence.getPatternNum());
   }
-  auto result = sendSetMessage<uint8_t, uint8_t, uint8_t, uint8_t>(
-      0x1A31, static_cast<uint8_t>(patternSequence.getPatternNum() - 1),
-      static_cast<uint8_t>(repeat),
-      static_cast<uint8_t>(patternNumPerTrigOut2 - 1),
-      static_cast<uint8_t>(0)); // Irrelevant unless PatternDataSource::INTERNAL
-  return (result != nullptr);
+  invalidate(batch.getDevice().getUploadRecord());
+  batch.set<commands::PatternConfig>(
+      patternSequence.getPatternNum() - 1, repeat, patternNumPerTrigOut2 - 1,
+      0); // Irrelevant unless PatternDataSource::INTERNAL
 }
 
 /**
  * configureVarExpPatSequence
  * CMD2 : 0x1A, CMD3 : 0x40, Param : 6
  */
-bool configureVarExpPatSequence(VarExpPatSequence &varExpPatSequence,
+bool configureVarExpPatSequence(USB::Device &device,
+                                VarExpPatSequence &varExpPatSequence,
+                                bool repeat, uint16_t varExpPatNumPerTrigOut2) {
+  Batch batch(device);
+  configureVarExpPatSequence(batch, varExpPatSequence, repeat,
+                             varExpPatNumPerTrigOut2);
+  return batch.commit();
+}
+
+void configureVarExpPatSequence(Batch &batch,
+                                VarExpPatSequence &varExpPatSequence,
                                 bool repeat, uint16_t varExpPatNumPerTrigOut2) {
   if (repeat) {
     varExpPatNumPerTrigOut2 =
         static_cast<uint16_t>(varExpPatSequence.getVarExpPatNum());
   }
-  auto result = sendSetMessage<uint16_t, uint16_t, uint8_t, uint8_t>(
-      0x1A40, static_cast<uint16_t>(varExpPatSequence.getVarExpPatNum() - 1),
-      static_cast<uint16_t>(varExpPatNumPerTrigOut2 - 1),
-      static_cast<uint8_t>(0), // Irrelevant unless PatternDataSource::INTERNAL
-      static_cast<uint8_t>(repeat));
-  return (result != nullptr);
+  invalidate(batch.getDevice().getUploadRecord());
+  batch.set<commands::VarExpPatConfig>(
+      varExpPatSequence.getVarExpPatNum() - 1, varExpPatNumPerTrigOut2 - 1,
+      0, // Irrelevant unless PatternDataSource::INTERNAL
+      repeat);
 }
 
 /**
  * sendPatternDisplayLUT
  * CMD2 : 0x1A, CMD3 : 0x34, Param : 3
+ * Only the entries that differ from the last upload to the device are sent.
  */
-bool sendPatternDisplayLUT(PatternSequence &patternSequence) {
-  if (!setMailboxMode(MailboxMode::PATTERN))
+bool sendPatternDisplayLUT(USB::Device &device,
+                           PatternSequence &patternSequence) {
+  Batch batch(device);
+  sendPatternDisplayLUT(batch, patternSequence);
+  return batch.commit();
+}
+
+bool sendPatternDisplayLUT(Batch &batch, PatternSequence &patternSequence) {
+  using LUT = commands::PatternLUT;
+  auto entry = [&patternSequence](size_t i) -> const void * {
+    return &patternSequence.getPattern(i).value;
+  };
+
+  auto &record = batch.getDevice().getUploadRecord();
+  size_t patternNum = patternSequence.getPatternNum();
+  auto ranges = findChanged<LUT>(record.patternLUT, patternNum, entry);
+  if (ranges.empty())
     return false;
 
-  setMailboxOffset(0);
+  // recorded ahead of the writes, a failed write clears the record
+  updateRecord<LUT>(record.patternLUT, patternNum, entry);
+  record.validated = false;
+
+  // the mailbox is opened and closed in the same burst as the entries
+  batch.set<commands::MailboxMode>(MailboxMode::PATTERN);
+  for (auto [first, last] : ranges) {
+    batch.set<commands::MailboxOffset>(first);
+    batch.setEntries<LUT>(last - first,
+                          [&entry, first, last](Encoder &encoder) {
+                            for (size_t i = first; i < last; i++) {
+                              addEntry<LUT>(encoder, entry(i));
+                            }
+                          });
+  }
+  batch.set<commands::MailboxMode>(MailboxMode::DISABLE);
+  return true;
+}
 
-  auto send = Message(Message::Type::WRITE, 0x1A34);
+/**
+ * getPatternDisplayLUT
+ * CMD2 : 0x1A, CMD3 : 0x34
+ */
+bool getPatternDisplayLUT(USB::Device &device,
+                          PatternSequence &patternSequence) {
+  if (!setMailboxMode(device, MailboxMode::PATTERN))
+    return false;
 
-  // TODO: possible to use sendSetMessage & addData?
-  for (size_t i = 0; i < patternSequence.getPatternNum(); i++) {
-    Pattern &pattern = patternSequence.getPattern(i);
-    uint8_t *value = reinterpret_cast<uint8_t *>(&pattern.value);
-    for (size_t j = 0; j < 3; j++) {
-      send.data[send.length++] = *(value++);
+  if (!setMailboxOffset(device, 0)) {
+    setMailboxMode(device, MailboxMode::DISABLE);
+    return false;
+  }
+
+  commands::PatternLUT::Reply value{};
+  size_t patternNum = 0;
+  bool result = false;
+  {
+    // the configured patterns span several reports
+    std::lock_guard<std::mutex> lock(device.getMutex());
+    auto received =
+        transactEncoded(device, Message::Type::READ,
+                        commands::PatternLUT::opcode, sizeof(uint16_t),
+                        [](Encoder &) {});
+    if (received) {
+      patternNum = std::min<size_t>(
+          received.getLength() / commands::PatternLUT::entrySize,
+          maxPatterns);
+      result = copyReply(device, received, value);
     }
   }
 
-  auto result = transact(send);
+  setMailboxMode(device, MailboxMode::DISABLE);
 
-  setMailboxMode(MailboxMode::DISABLE);
+  if (!result)
+    return false;
 
-  return (result != nullptr);
+  patternSequence.clear();
+  for (size_t i = 0; i < patternNum; i++) {
+    Pattern pattern;
+    memcpy(&pattern.value, &value[i * commands::PatternLUT::entrySize],
+           commands::PatternLUT::entrySize);
+    patternSequence.addPattern(pattern);
+  }
+  return true;
 }
 
 /**
  * sendVarExpPatDisplayLUT
- * CMD2 : 0x1A, CMD3 : 0x3E, Param : 12
- */
-bool sendVarExpPatDisplayLUT(VarExpPatSequence &varExpPatSequence) {
-  if (!setMailboxMode(MailboxMode::VAR_EXPOSURE_PATTERN))
+ * CMD2 : 0x1A, CMD3 : 0x3E, Param : 12 per entry, up to 42 per message
+ * Only the entries that differ from the last upload to the device are sent.
+ */
+bool sendVarExpPatDisplayLUT(USB::Device &device,
+                             VarExpPatSequence &varExpPatSequence) {
+  Batch batch(device);
+  sendVarExpPatDisplayLUT(batch, varExpPatSequence);
+  return batch.commit();
+}
+
+bool sendVarExpPatDisplayLUT(Batch &batch,
+                             VarExpPatSequence &varExpPatSequence) {
+  using LUT = commands::VarExpPatLUT;
+  auto entry = [&varExpPatSequence](size_t i) -> const void * {
+    return &varExpPatSequence.getVarExpPat(i);
+  };
+
+  auto &record = batch.getDevice().getUploadRecord();
+  size_t varExpPatNum = varExpPatSequence.getVarExpPatNum();
+  auto ranges = findChanged<LUT>(record.varExpPatLUT, varExpPatNum, entry);
+  if (ranges.empty())
     return false;
 
-  for (size_t i = 0; i < varExpPatSequence.getVarExpPatNum(); i++) {
-    setMailboxVarExpOffset(i);
-
-    auto send = Message(Message::Type::WRITE, 0x1A3E);
-
-    VarExpPat &varExpPat = varExpPatSequence.getVarExpPat(i);
-    uint8_t *value = reinterpret_cast<uint8_t *>(&varExpPat.pattern);
-    for (size_t j = 0; j < 12; j++) {
-      send.data[send.length++] = *(value++);
-    }
-    auto result = transact(send);
-    if (result == nullptr) {
-      return false;
-    }
+  // recorded ahead of the writes, a failed write clears the record
+  updateRecord<LUT>(record.varExpPatLUT, varExpPatNum, entry);
+  record.validated = false;
+
+  batch.set<commands::MailboxMode>(MailboxMode::VAR_EXPOSURE_PATTERN);
+
+  // the offset auto-increments over the entries of a message, so it is only
+  // set once per message
+  for (auto [first, last] : ranges) {
+    batch.set<commands::MailboxVarExpOffset>(first);
+    batch.setEntries<LUT>(last - first,
+                          [&entry, first, last](Encoder &encoder) {
+                            for (size_t i = first; i < last; i++) {
+                              addEntry<LUT>(encoder, entry(i));
+                            }
+                          });
   }
 
-  setMailboxMode(MailboxMode::DISABLE);
-
+  batch.set<commands::MailboxMode>(MailboxMode::DISABLE);
   return true;
 }
 
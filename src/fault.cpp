@@ -0,0 +1,110 @@
+#include "multi350/fault.hpp"
+#include "multi350/log.hpp"
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+namespace multi350 {
+namespace sim {
+
+namespace {
+// flags : destination(3), reserved(2), error(1), reply(1), rw(1)
+constexpr uint8_t errorFlag = 1 << 5;
+constexpr int32_t headerBytes = 4;
+} // namespace
+
+FaultTransport::FaultTransport(std::unique_ptr<USB::Transport> _inner,
+                               Faults _faults)
+    : inner{std::move(_inner)}, faults{_faults}, generator{_faults.seed},
+      failed{false} {}
+
+bool FaultTransport::isOpen() const { return !failed && inner->isOpen(); }
+
+void FaultTransport::close() { inner->close(); }
+
+bool FaultTransport::happens(double rate) {
+  return rate > 0 && std::bernoulli_distribution(rate)(generator);
+}
+
+bool FaultTransport::disconnect() {
+  if (!happens(faults.disconnectRate))
+    return false;
+
+  logWarning() << "[Fault] Disconnecting " << getPath();
+  ++stats.disconnects;
+  failed = true;
+  inner->close();
+  return true;
+}
+
+int32_t FaultTransport::read(uint8_t *data, size_t size, int32_t timeout) {
+  auto deadline = Clock::now() + std::chrono::milliseconds(timeout);
+
+  while (isOpen()) {
+    auto now = Clock::now();
+    if (!pending.empty()) {
+      auto &front = pending.front();
+      if (front.readyAt <= now) {
+        int32_t readBytes =
+            std::min(front.size, static_cast<int32_t>(size));
+        memcpy(data, front.report.data(), readBytes);
+        pending.pop_front();
+        return readBytes;
+      }
+      if (now >= deadline)
+        return 0;
+
+      std::this_thread::sleep_until(std::min(front.readyAt, deadline));
+      continue;
+    }
+
+    auto remaining = std::chrono::ceil<std::chrono::milliseconds>(
+        std::max(deadline - now, Clock::duration::zero()));
+    Pending reply;
+    reply.size = inner->read(reply.report.data(), reply.report.size(),
+                             static_cast<int32_t>(remaining.count()));
+    if (reply.size <= 0)
+      return reply.size;
+    ++stats.replies;
+
+    if (disconnect())
+      return -1;
+
+    if (happens(faults.dropRate)) {
+      ++stats.dropped;
+      continue;
+    }
+    if (happens(faults.errorRate)) {
+      ++stats.errors;
+      reply.report[0] |= errorFlag;
+    }
+    if (happens(faults.shortReadRate)) {
+      ++stats.shortReads;
+      reply.size = std::uniform_int_distribution<int32_t>(
+          1, std::min(reply.size, headerBytes + 8) - 1)(generator);
+    }
+
+    auto delay = faults.latency;
+    if (faults.jitter.count() > 0) {
+      delay += std::chrono::microseconds(
+          std::uniform_int_distribution<int64_t>(0, faults.jitter.count())(
+              generator));
+    }
+    if (happens(faults.spikeRate)) {
+      ++stats.spikes;
+      delay += faults.spike;
+    }
+    reply.readyAt = Clock::now() + delay;
+    pending.push_back(reply);
+  }
+
+  return -1;
+}
+
+int32_t FaultTransport::write(const uint8_t *data, size_t size) {
+  if (!isOpen() || disconnect())
+    return -1;
+  return inner->write(data, size);
+}
+}; // namespace sim
+}; // namespace multi350
@@ -0,0 +1,258 @@
+#include "multi350/hidraw.hpp"
+#include "multi350/log.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+namespace multi350 {
+namespace USB {
+
+HidrawReactor &HidrawReactor::instance() {
+  static HidrawReactor *reactor = new HidrawReactor();
+  return *reactor;
+}
+
+HidrawReactor::HidrawReactor()
+    : epollFd{epoll_create1(EPOLL_CLOEXEC)}, nextId{1} {
+  if (epollFd < 0) {
+    logError() << "[hidraw] Failed to create epoll instance: "
+               << strerror(errno);
+    return;
+  }
+  thread = std::thread(&HidrawReactor::run, this);
+}
+
+bool HidrawReactor::add(HidrawTransport &transport) {
+  if (epollFd < 0)
+    return false;
+
+  std::lock_guard<std::mutex> lock(mutex);
+
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.u64 = nextId;
+  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, transport.fd, &event) != 0) {
+    logError() << "[hidraw] Failed to watch " << transport.getPath() << ": "
+               << strerror(errno);
+    return false;
+  }
+
+  transport.id = nextId++;
+  transports[transport.id] = &transport;
+  return true;
+}
+
+void HidrawReactor::remove(HidrawTransport &transport) {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  if (transports.erase(transport.id) > 0) {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, transport.fd, nullptr);
+  }
+}
+
+void HidrawReactor::waitWritable(HidrawTransport &transport) {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  epoll_event event{};
+  event.events = EPOLLIN | EPOLLOUT;
+  event.data.u64 = transport.id;
+  epoll_ctl(epollFd, EPOLL_CTL_MOD, transport.fd, &event);
+}
+
+void HidrawReactor::run() {
+  constexpr int maxEvents = 64;
+  epoll_event events[maxEvents];
+
+  while (true) {
+    int eventNum = epoll_wait(epollFd, events, maxEvents, -1);
+    if (eventNum < 0) {
+      if (errno == EINTR)
+        continue;
+      logError() << "[hidraw] Event loop failed: " << strerror(errno);
+      return;
+    }
+
+    // Dispatch under the lock so remove() never races a callback
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int i = 0; i < eventNum; ++i) {
+      auto found = transports.find(events[i].data.u64);
+      if (found == transports.end())
+        continue;
+
+      HidrawTransport &transport = *found->second;
+      if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+        transport.onError();
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, transport.fd, nullptr);
+        transports.erase(found);
+        continue;
+      }
+      if (events[i].events & EPOLLIN) {
+        transport.onReadable();
+      }
+      if (events[i].events & EPOLLOUT) {
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u64 = transport.id;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, transport.fd, &event);
+        transport.onWritable();
+      }
+    }
+  }
+}
+
+HidrawTransport::HidrawTransport(int _fd, std::string _path)
+    : fd{_fd}, id{0}, path{std::move(_path)}, failed{false}, writable{true} {}
+
+HidrawTransport::~HidrawTransport() { close(); }
+
+std::unique_ptr<HidrawTransport>
+HidrawTransport::open(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+
+  auto transport = std::make_unique<HidrawTransport>(fd, path);
+  if (!HidrawReactor::instance().add(*transport)) {
+    return nullptr;
+  }
+  return transport;
+}
+
+void HidrawTransport::close() {
+  // the reactor looks the node up by fd, so it is unwatched before the fd is
+  // taken, and only the caller taking it closes it
+  HidrawReactor::instance().remove(*this);
+  int closed = fd.exchange(-1);
+  if (closed < 0)
+    return;
+
+  ::close(closed);
+  condition.notify_all();
+}
+
+int32_t HidrawTransport::read(uint8_t *data, size_t size, int32_t timeout) {
+  std::unique_lock<std::mutex> lock(mutex);
+  condition.wait_for(lock, std::chrono::milliseconds(timeout), [this] {
+    return !reports.empty() || !isOpen();
+  });
+
+  if (!reports.empty()) {
+    size_t readBytes = std::min(size, packetSize);
+    memcpy(data, reports.front().data(), readBytes);
+    reports.pop();
+    return static_cast<int32_t>(readBytes);
+  }
+
+  return isOpen() ? 0 : -1;
+}
+
+int32_t HidrawTransport::write(const uint8_t *data, size_t size) {
+  while (isOpen()) {
+    ssize_t writtenBytes = ::write(fd, data, size);
+    if (writtenBytes >= 0)
+      return static_cast<int32_t>(writtenBytes);
+    if (errno == EINTR)
+      continue;
+    if (errno != EAGAIN) {
+      failed = true;
+      return -1;
+    }
+
+    // Node is busy, let the event loop report when it is writable again
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      writable = false;
+    }
+    HidrawReactor::instance().waitWritable(*this);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!condition.wait_for(lock, std::chrono::milliseconds(readTimeout),
+                            [this] { return writable || !isOpen(); })) {
+      return -1;
+    }
+  }
+
+  return -1;
+}
+
+void HidrawTransport::onReadable() {
+  while (true) {
+    Report report;
+    ssize_t readBytes = ::read(fd, report.data(), report.size());
+    if (readBytes > 0) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        reports.push(report);
+      }
+      condition.notify_one();
+      continue;
+    }
+    if (readBytes < 0 && errno == EINTR)
+      continue;
+    if (readBytes < 0 && errno != EAGAIN)
+      onError();
+    return;
+  }
+}
+
+void HidrawTransport::onWritable() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    writable = true;
+  }
+  condition.notify_all();
+}
+
+void HidrawTransport::onError() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    failed = true;
+  }
+  condition.notify_all();
+}
+
+std::vector<DeviceInfo> enumerateHidraw() {
+  namespace fs = std::filesystem;
+
+  std::vector<DeviceInfo> infos;
+  std::error_code error;
+  for (auto &entry : fs::directory_iterator("/sys/class/hidraw", error)) {
+    std::ifstream uevent(entry.path() / "device" / "uevent");
+    unsigned int bus = 0, vendor = 0, product = 0;
+    bool matched = false, firstInterface = false;
+    std::string serial;
+
+    // HID_ID=0003:00000451:00006401, HID_PHYS=usb-0000:00:14.0-1/input0,
+    // HID_UNIQ=<serial number>
+    for (std::string line; std::getline(uevent, line);) {
+      if (line.rfind("HID_ID=", 0) == 0 &&
+          sscanf(line.c_str() + 7, "%x:%x:%x", &bus, &vendor, &product) == 3) {
+        matched = (vendor == vendorId && product == productId);
+      } else if (line.rfind("HID_PHYS=", 0) == 0) {
+        firstInterface = line.size() >= 7 &&
+                         line.compare(line.size() - 7, 7, "/input0") == 0;
+      } else if (line.rfind("HID_UNIQ=", 0) == 0) {
+        serial = line.substr(9);
+      }
+    }
+
+    if (matched && firstInterface) {
+      infos.push_back({"/dev/" + entry.path().filename().string(), serial});
+    }
+  }
+
+  std::sort(infos.begin(), infos.end(),
+            [](const DeviceInfo &a, const DeviceInfo &b) {
+              return a.path < b.path;
+            });
+  return infos;
+}
+}; // namespace USB
+}; // namespace multi350
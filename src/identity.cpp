@@ -0,0 +1,59 @@
+#include "multi350/identity.hpp"
+#include "multi350/log.hpp"
+#include <fstream>
+#include <sstream>
+
+namespace multi350 {
+
+bool IdentityMap::load(const std::string &file) {
+  std::ifstream stream(file);
+  if (!stream)
+    return false;
+
+  std::map<std::string, unsigned int> loaded;
+  for (std::string line; std::getline(stream, line);) {
+    if (line.empty())
+      continue;
+
+    std::istringstream entry(line);
+    unsigned int index;
+    std::string identity;
+    // the identity is the rest of the line, paths may contain spaces
+    if (!(entry >> index) || !std::getline(entry >> std::ws, identity) ||
+        identity.empty()) {
+      logError() << "[IdentityMap] Malformed entry in " << file << ": " << line;
+      return false;
+    }
+    loaded[identity] = index;
+  }
+
+  indices = std::move(loaded);
+  return true;
+}
+
+bool IdentityMap::save(const std::string &file) const {
+  std::ofstream stream(file, std::ios::trunc);
+  if (!stream) {
+    logError() << "[IdentityMap] Unable to write " << file;
+    return false;
+  }
+
+  for (auto &[identity, index] : indices) {
+    stream << index << " " << identity << "\n";
+  }
+
+  return static_cast<bool>(stream);
+}
+
+std::optional<unsigned int>
+IdentityMap::get(const std::string &identity) const {
+  auto entry = indices.find(identity);
+  if (entry == indices.end())
+    return std::nullopt;
+  return entry->second;
+}
+
+void IdentityMap::set(const std::string &identity, unsigned int index) {
+  indices[identity] = index;
+}
+}; // namespace multi350
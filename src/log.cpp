@@ -0,0 +1,200 @@
+#include "multi350/log.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+namespace multi350 {
+
+namespace {
+struct Record {
+  Severity severity;
+  size_t length;
+  std::array<char, logLineSize> line;
+};
+
+// bounded multi-producer queue after Vyukov: a cell is free for the producer
+// when its sequence equals the position, and ready for the consumer when it
+// is one past
+struct Cell {
+  std::atomic<uint64_t> sequence;
+  Record record;
+};
+
+void writeDefault(Severity severity, std::string_view line) {
+  auto &stream = severity >= Severity::WARNING ? std::cerr : std::cout;
+  stream << line << '\n';
+}
+
+class Logger {
+public:
+  Logger() {
+    for (size_t i = 0; i < logQueueSize; ++i) {
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    thread = std::thread(&Logger::run, this);
+  }
+
+  bool push(Severity severity, const char *line, size_t length) {
+    auto position = enqueuePosition.load(std::memory_order_relaxed);
+    Cell *cell;
+    for (;;) {
+      cell = &cells[position % logQueueSize];
+      auto sequence = cell->sequence.load(std::memory_order_acquire);
+      auto difference =
+          static_cast<int64_t>(sequence) - static_cast<int64_t>(position);
+      if (difference == 0) {
+        if (enqueuePosition.compare_exchange_weak(position, position + 1,
+                                                  std::memory_order_relaxed))
+          break;
+      } else if (difference < 0) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      } else {
+        position = enqueuePosition.load(std::memory_order_relaxed);
+      }
+    }
+
+    cell->record.severity = severity;
+    cell->record.length = length;
+    std::copy(line, line + length, cell->record.line.begin());
+    cell->sequence.store(position + 1, std::memory_order_release);
+
+    published.fetch_add(1, std::memory_order_release);
+    published.notify_one();
+    return true;
+  }
+
+  void write(Severity severity, std::string_view line) {
+    std::lock_guard<std::mutex> lock(sinkMutex);
+    if (sink)
+      sink(severity, line);
+    else
+      writeDefault(severity, line);
+  }
+
+  void flush() {
+    if (stopped)
+      return;
+
+    auto target = enqueuePosition.load(std::memory_order_acquire);
+    for (auto done = written.load(); done < target; done = written.load()) {
+      written.wait(done);
+    }
+  }
+
+  void stop() {
+    running = false;
+    published.fetch_add(1, std::memory_order_release);
+    published.notify_one();
+    thread.join();
+    stopped = true;
+  }
+
+  std::atomic<Severity> level{Severity::INFO};
+  std::atomic<uint64_t> dropped{0};
+  std::atomic<bool> stopped{false};
+  std::mutex sinkMutex;
+  LogSink sink;
+
+private:
+  bool pop(Record &record) {
+    auto &cell = cells[dequeuePosition % logQueueSize];
+    if (cell.sequence.load(std::memory_order_acquire) != dequeuePosition + 1)
+      return false;
+
+    record = cell.record;
+    cell.sequence.store(dequeuePosition + logQueueSize,
+                        std::memory_order_release);
+    ++dequeuePosition;
+    return true;
+  }
+
+  void run() {
+    Record record;
+    uint64_t reported = 0;
+    for (;;) {
+      auto seen = published.load(std::memory_order_acquire);
+      uint64_t taken = 0;
+      while (pop(record)) {
+        write(record.severity, {record.line.data(), record.length});
+        ++taken;
+      }
+
+      auto lost = dropped.load(std::memory_order_relaxed);
+      if (lost > reported) {
+        std::string line = "[Log] Queue full, dropped " +
+                           std::to_string(lost - reported) + " lines";
+        write(Severity::WARNING, line);
+        reported = lost;
+      }
+
+      if (taken > 0) {
+        {
+          std::lock_guard<std::mutex> lock(sinkMutex);
+          if (!sink)
+            std::cout.flush();
+        }
+        written.fetch_add(taken);
+        written.notify_all();
+      }
+
+      if (!running && dequeuePosition == enqueuePosition.load())
+        return;
+      published.wait(seen, std::memory_order_acquire);
+    }
+  }
+
+  std::array<Cell, logQueueSize> cells;
+  std::atomic<uint64_t> enqueuePosition{0};
+  uint64_t dequeuePosition{0}; // sink thread only
+  std::atomic<uint64_t> published{0};
+  std::atomic<uint64_t> written{0};
+  std::atomic<bool> running{true};
+  std::thread thread;
+};
+
+// never destroyed, lines logged by static destructors after the sink thread
+// stopped are written right away
+Logger &getLogger() {
+  static Logger *logger = [] {
+    auto *created = new Logger();
+    std::atexit([] { getLogger().stop(); });
+    return created;
+  }();
+  return *logger;
+}
+} // namespace
+
+void setLogLevel(Severity severity) { getLogger().level = severity; }
+
+Severity getLogLevel() { return getLogger().level; }
+
+void setLogSink(LogSink sink) {
+  auto &logger = getLogger();
+  std::lock_guard<std::mutex> lock(logger.sinkMutex);
+  logger.sink = std::move(sink);
+}
+
+void flushLog() { getLogger().flush(); }
+
+uint64_t getDroppedLogLines() { return getLogger().dropped; }
+
+LogLine::LogLine(Severity _severity)
+    : severity{_severity},
+      enabled{_severity >= getLogger().level.load(std::memory_order_relaxed)},
+      length{0} {}
+
+LogLine::~LogLine() {
+  if (!enabled)
+    return;
+
+  auto &logger = getLogger();
+  if (logger.stopped)
+    logger.write(severity, {line.data(), length});
+  else
+    logger.push(severity, line.data(), length);
+}
+}; // namespace multi350
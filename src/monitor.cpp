@@ -0,0 +1,133 @@
+#include "multi350/monitor.hpp"
+#include "multi350/log.hpp"
+
+namespace multi350 {
+namespace USB {
+
+Monitor::Monitor(Enumerator _enumerator, Opener _opener, Listener _listener,
+                 std::chrono::milliseconds _interval)
+    : enumerator{std::move(_enumerator)}, opener{std::move(_opener)},
+      listener{std::move(_listener)}, interval{_interval}, stopping{false},
+      woken{false} {
+  // devices opened before monitoring are known already
+  for (unsigned int i = 0; i < deviceNum(); ++i) {
+    auto *device = getDevice(i);
+    if (device && device->isOpen())
+      present.insert(device->getPath());
+  }
+
+  failureHandler = addFailureHandler([this](Device &) { wake(); });
+  thread = std::thread(&Monitor::run, this);
+}
+
+Monitor::Monitor(Backend backend, Listener _listener,
+                 std::chrono::milliseconds _interval)
+    : Monitor([backend] { return enumerate(backend); },
+              [backend](const std::string &path) {
+                return openTransport(path, backend);
+              },
+              std::move(_listener), _interval) {}
+
+Monitor::~Monitor() {
+  removeFailureHandler(failureHandler);
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  condition.notify_all();
+  thread.join();
+}
+
+void Monitor::poll() {
+  std::lock_guard<std::mutex> lock(pollMutex);
+
+  auto infos = enumerator();
+  std::set<std::string> current;
+  for (auto &info : infos) {
+    current.insert(info.path);
+  }
+
+  for (auto it = present.begin(); it != present.end();) {
+    if (current.count(*it)) {
+      ++it;
+      continue;
+    }
+
+    int index = findDevice(*it);
+    if (index >= 0) {
+      logInfo() << "[Monitor] Device removed: " << *it;
+      getDevice(index)->close();
+      if (listener)
+        listener(DeviceEvent::REMOVED, index);
+    }
+    it = present.erase(it);
+  }
+
+  // still plugged in but the transport failed, e.g. a brown-out too short to
+  // drop off the bus
+  for (auto &path : present) {
+    int index = findDevice(path);
+    auto *device = index >= 0 ? getDevice(index) : nullptr;
+    if (!device || device->isOpen())
+      continue;
+
+    auto transport = opener(path);
+    if (!transport)
+      continue;
+
+    logInfo() << "[Monitor] Device recovered: " << path;
+    device->reconnect(std::move(transport));
+    if (listener)
+      listener(DeviceEvent::RECONNECTED, index);
+  }
+
+  // enumeration order, so devices plugged in together get ordered slots
+  for (auto &info : infos) {
+    auto &path = info.path;
+    if (present.count(path))
+      continue;
+
+    auto transport = opener(path);
+    if (!transport) {
+      // retried on the next poll, the node may not be ready yet
+      logError() << "[Monitor] Failed to open device: " << path;
+      continue;
+    }
+    present.insert(path);
+
+    int index = findDevice(path);
+    if (index >= 0) {
+      logInfo() << "[Monitor] Device reconnected: " << path;
+      getDevice(index)->reconnect(std::move(transport));
+      if (listener)
+        listener(DeviceEvent::RECONNECTED, index);
+    } else {
+      logInfo() << "[Monitor] Device added: " << path;
+      attach(std::move(transport), info.serial);
+      if (listener)
+        listener(DeviceEvent::ADDED, findDevice(path));
+    }
+  }
+}
+
+void Monitor::wake() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    woken = true;
+  }
+  condition.notify_all();
+}
+
+void Monitor::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (!stopping) {
+    lock.unlock();
+    poll();
+    lock.lock();
+
+    condition.wait_for(lock, interval, [this] { return stopping || woken; });
+    woken = false;
+  }
+}
+}; // namespace USB
+}; // namespace multi350
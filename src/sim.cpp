@@ -0,0 +1,546 @@
+#include "multi350/sim.hpp"
+#include "multi350/commands.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace multi350 {
+namespace sim {
+
+namespace {
+// flags : destination(3), reserved(2), error(1), reply(1), rw(1)
+constexpr uint8_t errorFlag = 1 << 5;
+constexpr uint8_t replyFlag = 1 << 6;
+constexpr uint8_t readFlag = 1 << 7;
+
+constexpr uint16_t headerBytes = 4;
+constexpr uint8_t validationBusy = 1 << 7;
+constexpr uint8_t invalidPeriod = 1 << 0;
+constexpr uint8_t invalidPattern = 1 << 1;
+
+const char firmwareTag[] = "multi350 simulator";
+} // namespace
+
+Simulator::Simulator(std::string _serial, Timing _timing)
+    : serial{std::move(_serial)}, timing{_timing}, connected{true},
+      messageNum{0}, validationResult{0}, validated{false}, messageFlags{0},
+      messageSequence{0}, messageLength{0}, messageReceived{0},
+      messageData{0} {}
+
+size_t Simulator::receive(const uint8_t *packet,
+                          std::array<Reply, maxReplyReports> &replies) {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  // Every report occupies the interrupt endpoint for one interval
+  auto arrival = std::max(Clock::now(), linkFreeAt) + timing.packetInterval;
+  linkFreeAt = arrival;
+
+  if (messageReceived < messageLength) {
+    uint16_t bytes = std::min<uint16_t>(messageLength - messageReceived,
+                                        USB::packetSize);
+    memcpy(&messageData[messageReceived], packet, bytes);
+    messageReceived += bytes;
+  } else {
+    messageFlags = packet[0];
+    messageSequence = packet[1];
+    messageLength = std::min<uint16_t>(packet[2] | (packet[3] << 8),
+                                       messageData.size());
+    messageReceived = std::min<uint16_t>(messageLength,
+                                         USB::packetSize - headerBytes);
+    memcpy(messageData.data(), packet + headerBytes, messageReceived);
+  }
+
+  if (messageReceived < messageLength) {
+    return 0;
+  }
+
+  ++messageNum;
+  update(arrival);
+
+  std::array<uint8_t, maxMessageSize> payload{};
+  uint16_t payloadLength = 0;
+  bool success = execute(messageFlags, messageData.data(), messageLength,
+                         payload.data(), payloadLength, arrival);
+
+  // consume the message so the next report starts a new one
+  messageLength = 0;
+  messageReceived = 0;
+
+  if (!(messageFlags & replyFlag)) {
+    return 0;
+  }
+
+  auto &first = replies[0].report;
+  first.fill(0);
+  first[0] = success ? (messageFlags & ~errorFlag) : (messageFlags | errorFlag);
+  first[1] = messageSequence;
+  first[2] = static_cast<uint8_t>(payloadLength & 0xFF);
+  first[3] = static_cast<uint8_t>(payloadLength >> 8);
+
+  uint16_t sent = std::min<uint16_t>(payloadLength,
+                                     USB::packetSize - headerBytes);
+  memcpy(first.data() + headerBytes, payload.data(), sent);
+  replies[0].readyAt = std::max(arrival, deviceFreeAt) + timing.processing;
+
+  // continuations occupy the interrupt endpoint one interval each
+  size_t count = 1;
+  for (; sent < payloadLength; ++count) {
+    auto &report = replies[count].report;
+    uint16_t bytes = std::min<uint16_t>(payloadLength - sent, USB::packetSize);
+    report.fill(0);
+    memcpy(report.data(), &payload[sent], bytes);
+    sent += bytes;
+    replies[count].readyAt = replies[count - 1].readyAt + timing.packetInterval;
+  }
+
+  deviceFreeAt = replies[count - 1].readyAt;
+  return count;
+}
+
+Registers Simulator::getRegisters() {
+  std::lock_guard<std::mutex> lock(mutex);
+  update(Clock::now());
+  return registers;
+}
+
+void Simulator::update(Clock::time_point now) {
+  std::erase_if(deferred, [now](const Deferred &entry) {
+    if (entry.applyAt > now)
+      return false;
+    *entry.target = entry.value;
+    return true;
+  });
+
+  registers.validation =
+      (now < validationDoneAt) ? validationBusy : validationResult;
+}
+
+void Simulator::defer(uint8_t &target, uint8_t value, Clock::duration delay,
+                      Clock::time_point now) {
+  std::erase_if(deferred, [&target](const Deferred &entry) {
+    return entry.target == &target;
+  });
+
+  if (delay == Clock::duration::zero()) {
+    target = value;
+    return;
+  }
+  deferred.push_back({&target, value, now + delay});
+}
+
+bool Simulator::execute(uint8_t flags, const uint8_t *data, uint16_t length,
+                        uint8_t *payload, uint16_t &payloadLength,
+                        Clock::time_point now) {
+  if (length < 2)
+    return false;
+
+  bool read = flags & readFlag;
+  uint16_t command = data[0] | (data[1] << 8);
+  const uint8_t *params = data + 2;
+  uint16_t paramLength = length - 2;
+
+  // unknown commands and writes missing parameters are refused up front
+  auto *info = findCommand(command);
+  if (info == nullptr)
+    return false;
+  if (!read && !info->variable && paramLength < info->paramSize)
+    return false;
+
+  // Plain register read/write
+  auto access = [&](void *target, uint16_t size) {
+    if (read) {
+      memcpy(payload, target, size);
+      payloadLength = size;
+      return true;
+    }
+    if (paramLength < size)
+      return false;
+    memcpy(target, params, size);
+    return true;
+  };
+
+  switch (command) {
+  case commands::HardwareStatus::opcode: // init successful
+    payload[0] = 0x01;
+    payloadLength = 1;
+    return read;
+
+  case commands::SystemStatus::opcode: // memory test passed
+    payload[0] = 0x01;
+    payloadLength = 1;
+    return read;
+
+  case commands::MainStatus::opcode:
+    payload[0] = (registers.powerMode & 0x01) |
+                 ((registers.displayMode == 1 && registers.patternStatus == 2)
+                  << 1) |
+                 ((registers.gammaCorrection >> 7) << 3);
+    payloadLength = 1;
+    return read;
+
+  case commands::Version::opcode: {
+    const uint32_t version[4] = {0x04000000, 0x04000000, 0x01000000,
+                                 0x01000000};
+    memcpy(payload, version, sizeof(version));
+    payloadLength = sizeof(version);
+    return read;
+  }
+
+  case commands::FirmwareTag::opcode:
+    memcpy(payload, firmwareTag, sizeof(firmwareTag));
+    payloadLength = 32;
+    return read;
+
+  case commands::SoftwareReset::opcode:
+    if (read)
+      return false;
+    reset();
+    return true;
+
+  case commands::PowerMode::opcode:
+    if (read)
+      return access(&registers.powerMode, 1);
+    if (paramLength < 1)
+      return false;
+    defer(registers.powerMode, params[0] & 0x01, timing.powerModeSwitch, now);
+    return true;
+
+  case commands::ColorCurtain::opcode:
+    return access(registers.colorCurtain.data(), 6);
+
+  case commands::InputSource::opcode:
+    return access(&registers.inputSource, 1);
+
+  case commands::TestPattern::opcode:
+    return access(&registers.testPattern, 1);
+
+  case commands::LEDEnable::opcode:
+    return access(&registers.ledEnable, 1);
+
+  case commands::LEDCurrent::opcode:
+    return access(registers.ledCurrent.data(), 3);
+
+  case commands::DisplayMode::opcode: // switching stops the sequence
+    if (read)
+      return access(&registers.displayMode, 1);
+    if (paramLength < 1)
+      return false;
+    defer(registers.patternStatus, 0, Clock::duration::zero(), now);
+    defer(registers.displayMode, params[0] & 0x01, timing.displayModeSwitch,
+          now);
+    return true;
+
+  case commands::GammaCorrection::opcode:
+    return access(&registers.gammaCorrection, 1);
+
+  case commands::PatternTriggerMode::opcode:
+    validated = validated && read;
+    return access(&registers.patternTriggerMode, 1);
+
+  case commands::PatternDataSource::opcode:
+    return access(&registers.patternDataSource, 1);
+
+  case commands::PatternStatus::opcode: // only starts a validated sequence
+    if (read)
+      return access(&registers.patternStatus, 1);
+    if (paramLength < 1 || params[0] > 2)
+      return false;
+    if (params[0] == 2 && (registers.displayMode != 1 || !validated))
+      return true;
+    defer(registers.patternStatus, params[0], timing.patternStatusSwitch, now);
+    return true;
+
+  case commands::PatternPeriod::opcode:
+    if (read) {
+      memcpy(payload, &registers.exposure, 4);
+      memcpy(payload + 4, &registers.period, 4);
+      payloadLength = 8;
+      return true;
+    }
+    if (paramLength < 8)
+      return false;
+    memcpy(&registers.exposure, params, 4);
+    memcpy(&registers.period, params + 4, 4);
+    validated = false;
+    return true;
+
+  case commands::MailboxMode::opcode: // opening resets the offsets
+    if (read || paramLength < 1 || params[0] > 3)
+      return false;
+    registers.mailboxMode = params[0];
+    registers.mailboxOffset = 0;
+    registers.mailboxVarExpOffset = 0;
+    return true;
+
+  case commands::MailboxOffset::opcode:
+    if (read || paramLength < 1 || params[0] >= maxPatterns)
+      return false;
+    registers.mailboxOffset = params[0];
+    return true;
+
+  case commands::MailboxVarExpOffset::opcode: {
+    if (read || paramLength < 2)
+      return false;
+    uint16_t offset = params[0] | (params[1] << 8);
+    if (offset >= maxVarExpPats)
+      return false;
+    registers.mailboxVarExpOffset = offset;
+    return true;
+  }
+
+  case commands::PatternConfig::opcode:
+    validated = validated && read;
+    return access(registers.patternConfig.data(), 4);
+
+  case commands::VarExpPatConfig::opcode:
+    validated = validated && read;
+    return access(registers.varExpPatConfig.data(), 6);
+
+  case commands::PatternLUT::opcode: { // offset auto-increments
+    if (registers.mailboxMode != 2)
+      return false;
+    if (read) {
+      // the configured patterns from the offset on
+      size_t entries =
+          std::min<size_t>(registers.patternConfig[0] + 1,
+                           maxPatterns - registers.mailboxOffset);
+      memcpy(payload, &registers.patternLUT[registers.mailboxOffset * 3],
+             entries * 3);
+      payloadLength = static_cast<uint16_t>(entries * 3);
+      return true;
+    }
+    if (paramLength % 3 != 0)
+      return false;
+    size_t entries = paramLength / 3;
+    if (registers.mailboxOffset + entries > maxPatterns)
+      return false;
+    memcpy(&registers.patternLUT[registers.mailboxOffset * 3], params,
+           paramLength);
+    registers.mailboxOffset += entries;
+    validated = false;
+    return true;
+  }
+
+  case commands::VarExpPatLUT::opcode: { // offset auto-increments
+    if (read || registers.mailboxMode != 3 || paramLength % 12 != 0)
+      return false;
+    size_t entries = paramLength / 12;
+    if (registers.mailboxVarExpOffset + entries > maxVarExpPats)
+      return false;
+    memcpy(&registers.varExpPatLUT[registers.mailboxVarExpOffset * 12], params,
+           paramLength);
+    registers.mailboxVarExpOffset += entries;
+    validated = false;
+    return true;
+  }
+
+  case commands::PatternValidation::opcode: // busy bit is set until it finishes
+    if (!read) {
+      validationResult = validate();
+      validated = (validationResult == 0);
+      validationDoneAt = now + timing.validation;
+      update(now);
+    }
+    payload[0] = registers.validation;
+    payloadLength = 1;
+    return true;
+
+  default:
+    return false;
+  }
+}
+
+uint8_t Simulator::validate() {
+  uint8_t result = 0;
+
+  auto checkPattern = [&result](const uint8_t *entry) {
+    uint8_t bitDepth = entry[1] & 0x0F;
+    if (bitDepth == 0 || bitDepth > 8)
+      result |= invalidPattern;
+  };
+
+  if (registers.patternTriggerMode <= 2) {
+    size_t patternNum = registers.patternConfig[0] + 1;
+    if (registers.exposure == 0 || registers.exposure > registers.period)
+      result |= invalidPeriod;
+    for (size_t i = 0; i < patternNum; ++i) {
+      checkPattern(&registers.patternLUT[i * 3]);
+    }
+  } else {
+    size_t varExpPatNum =
+        (registers.varExpPatConfig[0] | (registers.varExpPatConfig[1] << 8)) +
+        1;
+    for (size_t i = 0; i < varExpPatNum && i < maxVarExpPats; ++i) {
+      const uint8_t *entry = &registers.varExpPatLUT[i * 12];
+      uint32_t exposure, period;
+      memcpy(&exposure, entry + 4, 4);
+      memcpy(&period, entry + 8, 4);
+      if (exposure == 0 || exposure > period)
+        result |= invalidPeriod;
+      checkPattern(entry);
+    }
+  }
+
+  return result;
+}
+
+void Simulator::reset() {
+  registers = Registers();
+  deferred.clear();
+  validationResult = 0;
+  validated = false;
+}
+
+SimTransport::SimTransport(std::shared_ptr<Simulator> _simulator,
+                           std::string _path)
+    : simulator{std::move(_simulator)}, path{std::move(_path)}, opened{true} {}
+
+bool SimTransport::isOpen() const {
+  return opened && simulator->isConnected();
+}
+
+void SimTransport::close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    opened = false;
+    replies.clear();
+  }
+  condition.notify_all();
+}
+
+int32_t SimTransport::read(uint8_t *data, size_t size, int32_t timeout) {
+  auto deadline = Clock::now() + std::chrono::milliseconds(timeout);
+  std::unique_lock<std::mutex> lock(mutex);
+
+  while (isOpen()) {
+    auto now = Clock::now();
+    if (!replies.empty() && replies.front().readyAt <= now) {
+      size_t readBytes = std::min(size, USB::packetSize);
+      memcpy(data, replies.front().report.data(), readBytes);
+      replies.pop();
+      return static_cast<int32_t>(readBytes);
+    }
+    if (now >= deadline)
+      return 0;
+
+    auto wakeAt = replies.empty()
+                      ? deadline
+                      : std::min(deadline, replies.front().readyAt);
+    condition.wait_until(lock, wakeAt);
+  }
+
+  return -1;
+}
+
+int32_t SimTransport::write(const uint8_t *data, size_t size) {
+  if (!isOpen() || size != USB::bufferSize)
+    return -1;
+
+  std::array<Simulator::Reply, Simulator::maxReplyReports> reply;
+  size_t count = simulator->receive(data + 1, reply);
+  if (count > 0) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (size_t i = 0; i < count; ++i) {
+        replies.push(reply[i]);
+      }
+    }
+    condition.notify_one();
+  }
+
+  return static_cast<int32_t>(size);
+}
+
+Simulator &Bus::add() {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  char id[8];
+  snprintf(id, sizeof(id), "%04u", nextId++);
+
+  Entry entry;
+  entry.info = {std::string("sim:") + id, std::string("SIM") + id,
+                USB::vendorId, USB::productId, 0};
+  entry.simulator = std::make_shared<Simulator>(entry.info.serial, timing);
+  entries.push_back(entry);
+
+  return *entries.back().simulator;
+}
+
+Simulator &Bus::replug(const std::string &path) {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  Entry entry;
+  entry.info = {path, "SIM" + path.substr(path.find(':') + 1), USB::vendorId,
+                USB::productId, 0};
+  entry.simulator = std::make_shared<Simulator>(entry.info.serial, timing);
+  entries.push_back(entry);
+
+  return *entries.back().simulator;
+}
+
+void Bus::add(unsigned int count) {
+  for (unsigned int i = 0; i < count; ++i) {
+    add();
+  }
+}
+
+bool Bus::remove(const std::string &path) {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  auto entry =
+      std::find_if(entries.begin(), entries.end(),
+                   [&path](const Entry &e) { return e.info.path == path; });
+  if (entry == entries.end())
+    return false;
+
+  entry->simulator->setConnected(false);
+  entries.erase(entry);
+  return true;
+}
+
+std::vector<DeviceInfo> Bus::enumerate() {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  std::vector<DeviceInfo> infos;
+  for (auto &entry : entries) {
+    infos.push_back(entry.info);
+  }
+  return infos;
+}
+
+std::unique_ptr<USB::Transport> Bus::open(const std::string &path) {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  for (auto &entry : entries) {
+    if (entry.info.path == path) {
+      return std::make_unique<SimTransport>(entry.simulator, path);
+    }
+  }
+  return nullptr;
+}
+
+std::vector<std::unique_ptr<USB::Transport>> Bus::openAll() {
+  std::vector<std::unique_ptr<USB::Transport>> transports;
+  for (auto &info : enumerate()) {
+    if (auto transport = open(info.path)) {
+      transports.push_back(std::move(transport));
+    }
+  }
+  return transports;
+}
+
+USB::Monitor::Enumerator Bus::getEnumerator() {
+  return [this] {
+    std::vector<USB::DeviceInfo> infos;
+    for (auto &info : enumerate()) {
+      infos.push_back({info.path, info.serial});
+    }
+    return infos;
+  };
+}
+
+USB::Monitor::Opener Bus::getOpener() {
+  return [this](const std::string &path) { return open(path); };
+}
+}; // namespace sim
+}; // namespace multi350
@@ -0,0 +1,293 @@
+#include "multi350/trace.hpp"
+#include "multi350/commands.hpp"
+#include "multi350/log.hpp"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <tuple>
+
+namespace multi350 {
+
+namespace {
+constexpr char magic[] = "M350TRC";
+constexpr uint8_t version = 1;
+
+template <typename T> void put(std::ostream &stream, T value) {
+  using Bits = std::make_unsigned_t<T>;
+  auto bits = static_cast<Bits>(value);
+  for (size_t i = 0; i < sizeof(T); ++i) {
+    stream.put(static_cast<char>((bits >> (8 * i)) & 0xFF));
+  }
+}
+
+template <typename T> bool get(std::istream &stream, T &value) {
+  std::make_unsigned_t<T> bits = 0;
+  for (size_t i = 0; i < sizeof(T); ++i) {
+    int byte = stream.get();
+    if (byte == EOF)
+      return false;
+    bits |= static_cast<decltype(bits)>(byte) << (8 * i);
+  }
+  value = static_cast<T>(bits);
+  return true;
+}
+
+// event stored as atomic words, so a dump copying it races with no write
+struct Slot {
+  // 2 * index + 1 while event index is stored, 2 * index + 2 once it is
+  std::atomic<uint64_t> sequence{0};
+  std::array<std::atomic<uint64_t>, sizeof(TraceEvent) / sizeof(uint64_t)>
+      words{};
+};
+
+// written by its thread only, head is published after the event is stored
+struct Ring {
+  uint16_t thread;
+  std::atomic<uint64_t> head{0};
+  std::array<Slot, traceRingSize> slots;
+};
+} // namespace
+
+namespace internal {
+std::atomic<bool> tracing{false};
+}; // namespace internal
+
+// rings outlive their threads, so the last events of a thread are dumped too
+static std::mutex ringsMutex;
+static std::vector<std::shared_ptr<Ring>> rings;
+
+static std::mutex devicesMutex;
+static std::vector<std::string> devices;
+
+static Ring &getRing() {
+  thread_local std::shared_ptr<Ring> ring = [] {
+    auto created = std::make_shared<Ring>();
+    std::lock_guard<std::mutex> lock(ringsMutex);
+    created->thread = static_cast<uint16_t>(rings.size());
+    rings.push_back(created);
+    return created;
+  }();
+  return *ring;
+}
+
+void internal::appendTrace(const TraceEvent &event) {
+  auto &ring = getRing();
+  auto head = ring.head.load(std::memory_order_relaxed);
+  auto &slot = ring.slots[head % traceRingSize];
+  std::array<uint64_t, std::tuple_size_v<decltype(slot.words)>> words;
+  memcpy(words.data(), &event, sizeof(event));
+
+  slot.sequence.store(2 * head + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  for (size_t i = 0; i < words.size(); ++i)
+    slot.words[i].store(words[i], std::memory_order_relaxed);
+  slot.sequence.store(2 * head + 2, std::memory_order_release);
+  ring.head.store(head + 1, std::memory_order_release);
+}
+
+void setTracing(bool enabled) { internal::tracing = enabled; }
+
+uint8_t traceDevice(const std::string &identity) {
+  std::lock_guard<std::mutex> lock(devicesMutex);
+  // a reconnected device keeps its id
+  auto known = std::find(devices.begin(), devices.end(), identity);
+  if (known != devices.end())
+    return static_cast<uint8_t>(known - devices.begin());
+  if (devices.size() <= UINT8_MAX)
+    devices.push_back(identity);
+  return static_cast<uint8_t>(devices.size() - 1);
+}
+
+bool dumpTrace(const std::string &file) {
+  std::ofstream stream(file, std::ios::binary | std::ios::trunc);
+  if (!stream) {
+    logError() << "[Trace] Unable to write " << file;
+    return false;
+  }
+
+  stream.write(magic, sizeof(magic) - 1);
+  stream.put(static_cast<char>(version));
+  {
+    std::lock_guard<std::mutex> lock(devicesMutex);
+    put<uint16_t>(stream, static_cast<uint16_t>(devices.size()));
+    for (auto &identity : devices) {
+      auto length = std::min<size_t>(identity.size(), 255);
+      stream.put(static_cast<char>(length));
+      stream.write(identity.data(), length);
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(ringsMutex);
+  put<uint16_t>(stream, static_cast<uint16_t>(rings.size()));
+  auto copy = std::make_unique<std::array<TraceEvent, traceRingSize>>();
+  for (auto &ring : rings) {
+    auto head = ring->head.load(std::memory_order_acquire);
+    uint64_t first = head > traceRingSize ? head - traceRingSize : 0;
+
+    // slots overwritten or being written while copied are left out
+    size_t count = 0;
+    for (auto i = first; i < head; ++i) {
+      auto &slot = ring->slots[i % traceRingSize];
+      if (slot.sequence.load(std::memory_order_acquire) != 2 * i + 2)
+        continue;
+      std::array<uint64_t, std::tuple_size_v<decltype(slot.words)>> words;
+      for (size_t j = 0; j < words.size(); ++j)
+        words[j] = slot.words[j].load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.sequence.load(std::memory_order_relaxed) != 2 * i + 2)
+        continue;
+      memcpy(&(*copy)[count++], words.data(), sizeof(TraceEvent));
+    }
+
+    put<uint16_t>(stream, ring->thread);
+    put<uint32_t>(stream, static_cast<uint32_t>(count));
+    for (size_t i = 0; i < count; ++i) {
+      auto &event = (*copy)[i];
+      put<int64_t>(stream, event.time);
+      put<uint16_t>(stream, event.command);
+      put<uint16_t>(stream, event.length);
+      stream.put(static_cast<char>(event.device));
+      stream.put(static_cast<char>(event.type));
+      stream.put(static_cast<char>(event.sequence));
+      stream.put(static_cast<char>(event.flags));
+    }
+  }
+
+  if (!stream) {
+    logError() << "[Trace] Failed to write " << file;
+    return false;
+  }
+  return true;
+}
+
+bool TraceLog::load(const std::string &file) {
+  std::ifstream stream(file, std::ios::binary);
+  if (!stream) {
+    logError() << "[Trace] Unable to read " << file;
+    return false;
+  }
+
+  char header[sizeof(magic)] = {};
+  stream.read(header, sizeof(magic) - 1);
+  if (!stream || memcmp(header, magic, sizeof(magic) - 1) != 0 ||
+      stream.get() != version) {
+    logError() << "[Trace] Not a trace: " << file;
+    return false;
+  }
+
+  devices.clear();
+  entries.clear();
+  uint16_t deviceNum = 0;
+  get(stream, deviceNum);
+  for (uint16_t i = 0; i < deviceNum && stream; ++i) {
+    uint8_t length = 0;
+    std::string identity;
+    if (get(stream, length)) {
+      identity.resize(length);
+      stream.read(identity.data(), length);
+    }
+    devices.push_back(std::move(identity));
+  }
+
+  uint16_t threadNum = 0;
+  if (!stream || !get(stream, threadNum)) {
+    logError() << "[Trace] Malformed device table";
+    return false;
+  }
+
+  for (uint16_t i = 0; i < threadNum; ++i) {
+    uint16_t thread;
+    uint32_t count;
+    if (!get(stream, thread) || !get(stream, count)) {
+      logError() << "[Trace] Truncated thread " << i;
+      return false;
+    }
+
+    for (uint32_t j = 0; j < count; ++j) {
+      Entry entry{thread, {}};
+      auto &event = entry.event;
+      uint8_t type;
+      if (!get(stream, event.time) || !get(stream, event.command) ||
+          !get(stream, event.length) || !get(stream, event.device) ||
+          !get(stream, type) || !get(stream, event.sequence) ||
+          !get(stream, event.flags)) {
+        logError() << "[Trace] Truncated thread " << thread;
+        return false;
+      }
+      if (type < static_cast<uint8_t>(TraceEvent::Type::WRITE) ||
+          type > static_cast<uint8_t>(TraceEvent::Type::FAILURE) ||
+          event.device >= devices.size()) {
+        logError() << "[Trace] Malformed event of thread " << thread;
+        return false;
+      }
+      event.type = static_cast<TraceEvent::Type>(type);
+      entries.push_back(entry);
+    }
+  }
+
+  std::stable_sort(entries.begin(), entries.end(), [](auto &a, auto &b) {
+    return a.event.time < b.event.time;
+  });
+  return true;
+}
+
+void TraceLog::print(std::ostream &out) const {
+  // replies are matched to the last message written with their sequence
+  struct Sent {
+    uint16_t command{0};
+    int64_t time{0};
+  };
+  std::vector<std::array<Sent, 256>> sent(devices.size());
+
+  int64_t start = entries.empty() ? 0 : entries.front().event.time;
+  for (auto &[thread, event] : entries) {
+    auto &written = sent[event.device][event.sequence];
+    if (event.type == TraceEvent::Type::WRITE)
+      written = {event.command, event.time};
+
+    auto *info = findCommand(written.command);
+    out << std::setw(10) << (event.time - start) / 1000 << "us T" << thread
+        << " " << devices[event.device] << " ";
+    switch (event.type) {
+    case TraceEvent::Type::WRITE:
+      out << "W";
+      break;
+    case TraceEvent::Type::READ:
+      out << "R";
+      break;
+    case TraceEvent::Type::TIMEOUT:
+      out << "timeout";
+      break;
+    default:
+      out << "failure";
+      break;
+    }
+    if (event.type != TraceEvent::Type::WRITE &&
+        event.type != TraceEvent::Type::READ) {
+      out << std::endl;
+      continue;
+    }
+
+    Message::Flags flags;
+    memcpy(&flags, &event.flags, sizeof(flags));
+    out << " seq " << static_cast<unsigned int>(event.sequence) << " "
+        << (info != nullptr ? info->name : "Unknown") << " (0x" << std::hex
+        << std::setfill('0') << std::setw(4) << written.command << std::dec
+        << std::setfill(' ') << ") "
+        << (flags.rw == Message::Type::READ ? "get " : "set ") << event.length
+        << " bytes";
+    if (event.type == TraceEvent::Type::READ) {
+      out << " after " << (event.time - written.time) / 1000 << "us";
+      if (flags.error)
+        out << " error";
+    } else if (!flags.reply) {
+      out << " no ack";
+    }
+    out << std::endl;
+  }
+}
+}; // namespace multi350
@@ -0,0 +1,117 @@
+#include "multi350/transport.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace multi350 {
+namespace USB {
+
+HidTransport::HidTransport(hid_device *_handle, std::string _path)
+    : handle{_handle}, path{std::move(_path)} {}
+
+HidTransport::~HidTransport() { close(); }
+
+std::unique_ptr<HidTransport> HidTransport::open(const char *path) {
+  hid_device *handle = hid_open_path(path);
+  if (!handle) {
+    return nullptr;
+  }
+  return std::make_unique<HidTransport>(handle, path);
+}
+
+void HidTransport::close() {
+  // only the caller taking the handle closes it
+  if (auto *closed = handle.exchange(nullptr))
+    hid_close(closed);
+}
+
+int32_t HidTransport::read(uint8_t *data, size_t size, int32_t timeout) {
+  auto *opened = handle.load();
+  if (!opened)
+    return -1;
+  return hid_read_timeout(opened, data, size, timeout);
+}
+
+int32_t HidTransport::write(const uint8_t *data, size_t size) {
+  auto *opened = handle.load();
+  if (!opened)
+    return -1;
+  return hid_write(opened, data, size);
+}
+
+LoopbackTransport::LoopbackTransport(std::string _path, Responder _responder)
+    : path{std::move(_path)}, responder{std::move(_responder)}, opened{true},
+      continuationBytes{0} {}
+
+void LoopbackTransport::close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    opened = false;
+    reports.clear();
+  }
+  condition.notify_all();
+}
+
+int32_t LoopbackTransport::read(uint8_t *data, size_t size, int32_t timeout) {
+  std::unique_lock<std::mutex> lock(mutex);
+  condition.wait_for(lock, std::chrono::milliseconds(timeout),
+                     [this] { return !reports.empty() || !opened; });
+
+  if (!opened)
+    return -1;
+  if (reports.empty())
+    return 0;
+
+  size_t readBytes = std::min(size, packetSize);
+  memcpy(data, reports.front().data(), readBytes);
+  reports.pop();
+  return static_cast<int32_t>(readBytes);
+}
+
+int32_t LoopbackTransport::write(const uint8_t *data, size_t size) {
+  if (!opened || size != bufferSize)
+    return -1;
+
+  // Responder may push replies, so it runs without holding the lock
+  if (responder) {
+    responder(data + 1, *this);
+  } else {
+    echo(data + 1);
+  }
+
+  return static_cast<int32_t>(size);
+}
+
+void LoopbackTransport::push(const uint8_t *packet, size_t size) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!opened)
+      return;
+    Report report{};
+    memcpy(report.data(), packet, std::min(size, packetSize));
+    reports.push(report);
+  }
+  condition.notify_one();
+}
+
+void LoopbackTransport::echo(const uint8_t *packet) {
+  constexpr uint16_t headerBytes = 4;
+
+  // Continuation packets of a long message carry no header
+  if (continuationBytes > 0) {
+    continuationBytes -= std::min<uint16_t>(continuationBytes, packetSize);
+    return;
+  }
+
+  uint16_t length = packet[2] | (packet[3] << 8);
+  if (length > packetSize - headerBytes) {
+    continuationBytes = length - (packetSize - headerBytes);
+  }
+
+  // flags : destination(3), reserved(2), error(1), reply(1), rw(1)
+  if (packet[0] & (1 << 6)) {
+    push(packet, packetSize);
+  }
+}
+}; // namespace USB
+}; // namespace multi350
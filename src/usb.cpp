@@ -1,124 +1,338 @@
 #include "multi350/usb.hpp"
+#include "multi350/async.hpp"
+#include "multi350/capture.hpp"
+#include "multi350/hidraw.hpp"
+#include "multi350/log.hpp"
+#include "multi350/trace.hpp"
+#include "multi350/transport.hpp"
+#include <algorithm>
+#include <future>
 #include <iostream>
+#include <map>
 
 namespace multi350 {
 namespace USB {
 
-hid_device *device = nullptr;
-std::vector<hid_device *> devices;
+std::vector<std::unique_ptr<Device>> devices;
 
-inline bool init() { return (hid_init() == 0); }
+// guards the device list against the hot-plug monitor, devices themselves are
+// never moved or destroyed while open
+static std::mutex devicesMutex;
 
-inline bool exit() { return (hid_exit() == 0); }
+// hands an exchanged report to the recorder, if one is installed
+static void record(const Device &device, CaptureEntry::Type type,
+                   const uint8_t *packet, int32_t size) {
+  if (auto *recorder = getRecorder())
+    recorder->record(device, type, packet, size > 0 ? size : 0);
+}
 
-inline bool open() {
-  if (!devices.empty())
-    close();
+// keyed by the id returned to the caller that added the handler
+static std::mutex failureMutex;
+static std::map<unsigned int, FailureHandler> failureHandlers;
+static unsigned int nextFailureHandler = 0;
 
-  hid_device_info *hid_info;
-  hid_info = hid_enumerate(vendorId, productId);
-  if (!hid_info) {
-    return false;
+int32_t Watchdog::getTimeout(Deadline deadline) const {
+  int32_t timeout = deadlineTimeout(deadline);
+  int64_t usual = latency;
+  if (usual == 0 || (deadline == Deadline::LONG && responsive))
+    return timeout;
+
+  int64_t bound =
+      std::max<int64_t>(watchdogMinimum, watchdogFactor * usual / 1000);
+  return static_cast<int32_t>(std::min<int64_t>(timeout, bound));
+}
+
+void Watchdog::observe(std::chrono::microseconds sample, Deadline deadline) {
+  responsive = true;
+
+  // long commands take as long as the transition, not the usual latency
+  if (deadline == Deadline::LONG)
+    return;
+
+  int64_t usual = latency;
+  latency =
+      (usual == 0) ? sample.count() : usual + (sample.count() - usual) / 8;
+}
+
+Device::Device(std::unique_ptr<Transport> _transport, std::string _serial)
+    : transport{std::move(_transport)}, path{transport->getPath()},
+      serial{std::move(_serial)}, traceId{traceDevice(getIdentity())},
+      inBuffer{0}, outBuffer{0}, sequence{0}, stale{false} {}
+
+Device::~Device() {
+  // fail pending asynchronous messages before the transport goes away
+  worker.reset();
+  close();
+}
+
+bool Device::isOpen() const {
+  std::lock_guard<std::mutex> lock(transportMutex);
+  return transport->isOpen();
+}
+
+void Device::close() {
+  std::lock_guard<std::mutex> lock(mutex);
+  std::lock_guard<std::mutex> transportLock(transportMutex);
+  transport->close();
+}
+
+void Device::reconnect(std::unique_ptr<Transport> _transport) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto previous = std::move(transport);
+  // the device may have been reset, it has to be uploaded to from scratch
+  uploadRecord.clear();
+  {
+    std::lock_guard<std::mutex> transportLock(transportMutex);
+    transport = std::move(_transport);
   }
+  previous->close();
+}
 
-  while (hid_info) {
-    if (hid_info->interface_number == 0) {
-      device = hid_open_path(hid_info->path);
+AsyncWorker &Device::getWorker() {
+  std::call_once(workerStarted,
+                 [this] { worker = std::make_unique<AsyncWorker>(*this); });
+  return *worker;
+}
 
-      if (!device) {
-        std::wcerr << "[HID] Failed to open device: " << hid_info->serial_number
-                   << std::endl;
-        close();
-        return false;
-      }
+int32_t Device::read(Deadline deadline) {
+  if (!transport->isOpen())
+    return -1;
 
-      devices.push_back(device);
-    }
-    hid_info = hid_info->next;
-    device = nullptr; // reset to default
+  int32_t timeout = watchdog.getTimeout(deadline);
+  int32_t readBytes = transport->read(inBuffer.data(), bufferSize, timeout);
+  record(*this,
+         readBytes > 0    ? CaptureEntry::Type::READ
+         : readBytes == 0 ? CaptureEntry::Type::TIMEOUT
+                          : CaptureEntry::Type::FAILURE,
+         inBuffer.data(), readBytes);
+
+  if (readBytes == -1) {
+    logError() << "USB Read failed: " << getPath();
+    fail();
+    return -1;
   }
 
-  return true;
+  if (readBytes == 0) {
+    logWarning() << "[USB] No reply within " << timeout
+                 << "ms, device unresponsive: " << getPath();
+    watchdog.expire();
+    stale = true;
+    return 0;
+  }
+
+  watchdog.observe(std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::steady_clock::now() - lastWrite),
+                   deadline);
+  return readBytes;
 }
 
-inline void close() {
-  for (auto *handle : devices) {
-    hid_close(handle);
+unsigned int Device::drain() {
+  if (!stale)
+    return 0;
+  stale = false;
+
+  // bounded by the input queue, a device flooding reports is left to the
+  // reply matching
+  unsigned int drained = 0;
+  while (drained < reportQueueSize && transport->isOpen()) {
+    int32_t readBytes = transport->read(inBuffer.data(), bufferSize, 0);
+    if (readBytes <= 0)
+      break;
+
+    record(*this, CaptureEntry::Type::READ, inBuffer.data(), readBytes);
+    ++drained;
   }
-  devices.clear();
-  device = nullptr;
+
+  if (drained > 0) {
+    logWarning() << "[USB] Discarded " << drained << " stale reports: "
+                 << getPath();
+  }
+  return drained;
 }
 
-inline bool isConnected() { return !devices.empty(); }
+int32_t Device::write() {
+  if (!transport->isOpen())
+    return -1;
 
-inline unsigned int deviceNum() { return devices.size(); }
+  outBuffer[0] = 0;
+  lastWrite = std::chrono::steady_clock::now();
+  int32_t writtenBytes = transport->write(outBuffer.data(), bufferSize);
+  record(*this,
+         writtenBytes == -1 ? CaptureEntry::Type::FAILURE
+                            : CaptureEntry::Type::WRITE,
+         outBuffer.data() + 1, writtenBytes == -1 ? 0 : packetSize);
 
-inline bool select(unsigned int index) {
-  if (index >= devices.size()) {
-    std::cerr << "Unable to select device " << index << std::endl;
+  if (writtenBytes == -1) {
+    logError() << "USB Write failed: " << getPath();
+    fail();
+    return -1;
+  }
+
+  return writtenBytes;
+}
+
+void Device::fail() {
+  // only this device is closed, the others keep running
+  {
+    std::lock_guard<std::mutex> transportLock(transportMutex);
+    transport->close();
+  }
+
+  std::lock_guard<std::mutex> lock(failureMutex);
+  for (auto &[id, handler] : failureHandlers)
+    handler(*this);
+}
+
+unsigned int addFailureHandler(FailureHandler handler) {
+  std::lock_guard<std::mutex> lock(failureMutex);
+  failureHandlers.emplace(nextFailureHandler, std::move(handler));
+  return nextFailureHandler++;
+}
+
+void removeFailureHandler(unsigned int id) {
+  std::lock_guard<std::mutex> lock(failureMutex);
+  failureHandlers.erase(id);
+}
+
+bool init() { return (hid_init() == 0); }
+
+bool exit() { return (hid_exit() == 0); }
+
+bool open(Backend backend) {
+  if (isConnected())
+    close();
+
+#ifndef __linux__
+  if (backend == Backend::HIDRAW) {
+    logError() << "[hidraw] Backend is only available on Linux";
+    return false;
+  }
+#endif
+
+  auto infos = enumerate(backend);
+  if (infos.empty()) {
     return false;
   }
 
-  device = devices[index];
+  // opening may probe the device, so all of them are opened at once
+  std::vector<std::future<std::unique_ptr<Transport>>> opening;
+  for (auto &info : infos) {
+    opening.push_back(std::async(std::launch::async, [&info, backend] {
+      return openTransport(info.path, backend);
+    }));
+  }
+
+  std::vector<std::unique_ptr<Transport>> transports;
+  for (auto &transport : opening) {
+    transports.push_back(transport.get());
+  }
+
+  for (size_t i = 0; i < infos.size(); ++i) {
+    if (!transports[i]) {
+      logError() << "[USB] Failed to open device: " << infos[i].path;
+      close();
+      return false;
+    }
+
+    attach(std::move(transports[i]), infos[i].serial);
+  }
+
   return true;
 }
 
-inline void printDevices() {
-  struct hid_device_info *hid_info;
-  hid_info = hid_enumerate(vendorId, productId);
-  std::cout << "[Device List]" << std::endl;
-  while (hid_info) {
+std::vector<DeviceInfo> enumerate(Backend backend) {
+  if (backend == Backend::HIDRAW) {
+#ifdef __linux__
+    return enumerateHidraw();
+#else
+    return {};
+#endif
+  }
+
+  std::vector<DeviceInfo> infos;
+  hid_device_info *hid_enum = hid_enumerate(vendorId, productId);
+  for (auto *hid_info = hid_enum; hid_info; hid_info = hid_info->next) {
     if (hid_info->interface_number == 0) {
-      std::cout << " path: " << hid_info->path << std::endl;
-      // std::wcout << "  manufacturer: " << hid_info->manufacturer_string
-      // << std::endl;
-      // std::wcout << "  product: " << hid_info->product_string << std::endl;
-      // std::wcout << "  S/N: " << hid_info->serial_number << std::endl;
+      std::string serial;
+      for (auto *c = hid_info->serial_number; c && *c; ++c) {
+        serial.push_back(static_cast<char>(*c));
+      }
+      infos.push_back({hid_info->path, serial});
     }
-    hid_info = hid_info->next;
   }
-}
+  hid_free_enumeration(hid_enum);
 
-inline Buffer read() {
-  if (!isConnected())
-    return nullptr;
+  return infos;
+}
 
-  if (!device) {
-    std::cerr << "Device not selected" << std::endl;
+std::unique_ptr<Transport> openTransport(const std::string &path,
+                                         Backend backend) {
+  if (backend == Backend::HIDRAW) {
+#ifdef __linux__
+    return HidrawTransport::open(path);
+#else
     return nullptr;
+#endif
   }
 
-  Buffer ret(new uint8_t[bufferSize]);
-  int32_t readBytes =
-      hid_read_timeout(device, ret.get(), bufferSize, readTimeout);
+  return HidTransport::open(path.c_str());
+}
 
-  if (readBytes == -1) {
-    std::cerr << "USB Read failed" << std::endl;
-    close();
-    return nullptr;
-  }
+void close() {
+  std::lock_guard<std::mutex> lock(devicesMutex);
+  devices.clear();
+}
 
-  return ret;
+bool isConnected() {
+  std::lock_guard<std::mutex> lock(devicesMutex);
+  return !devices.empty();
 }
 
-inline int32_t write(Buffer &data) {
-  if (!isConnected())
-    return -1;
+unsigned int deviceNum() {
+  std::lock_guard<std::mutex> lock(devicesMutex);
+  return devices.size();
+}
 
-  if (!device) {
-    std::cerr << "Device not selected" << std::endl;
-    return -1;
+Device &attach(std::unique_ptr<Transport> transport,
+              const std::string &serial) {
+  std::lock_guard<std::mutex> lock(devicesMutex);
+  devices.push_back(std::make_unique<Device>(std::move(transport), serial));
+  return *devices.back();
+}
+
+int findDevice(const std::string &path) {
+  std::lock_guard<std::mutex> lock(devicesMutex);
+  for (size_t i = 0; i < devices.size(); ++i) {
+    if (devices[i]->getPath() == path)
+      return static_cast<int>(i);
   }
 
-  int32_t writtenBytes = hid_write(device, data.get(), bufferSize);
+  return -1;
+}
 
-  if (writtenBytes == -1) {
-    std::cerr << "USB Write failed" << std::endl;
-    close();
-    return -1;
+Device *getDevice(unsigned int index) {
+  std::lock_guard<std::mutex> lock(devicesMutex);
+  if (index >= devices.size()) {
+    logError() << "Unable to select device " << index;
+    return nullptr;
   }
 
-  return writtenBytes;
+  return devices[index].get();
+}
+
+void printDevices() {
+  hid_device_info *hid_enum = hid_enumerate(vendorId, productId);
+  std::cout << "[Device List]" << std::endl;
+  for (auto *hid_info = hid_enum; hid_info; hid_info = hid_info->next) {
+    if (hid_info->interface_number == 0) {
+      std::cout << " path: " << hid_info->path << std::endl;
+      // std::wcout << "  manufacturer: " << hid_info->manufacturer_string
+      // << std::endl;
+      // std::wcout << "  product: " << hid_info->product_string << std::endl;
+      // std::wcout << "  S/N: " << hid_info->serial_number << std::endl;
+    }
+  }
+  hid_free_enumeration(hid_enum);
 }
 }; // namespace USB
 }; // namespace multi350
@@ -0,0 +1,24 @@
+// Decodes a trace dump written by multi350::dumpTrace and prints every
+// message and reply in the order they were exchanged, with the command,
+// sequence number, length and the round trip of each reply.
+//
+// Usage: multi350_trace <dump>
+
+#include "multi350/trace.hpp"
+#include <iostream>
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    std::cerr << "Usage: " << argv[0] << " <dump>" << std::endl;
+    return 1;
+  }
+
+  multi350::TraceLog log;
+  if (!log.load(argv[1]))
+    return 1;
+
+  std::cout << "[Trace] " << log.getEntries().size() << " events of "
+            << log.getDevices().size() << " devices" << std::endl;
+  log.print(std::cout);
+  return 0;
+}